@@ -1,18 +1,33 @@
+#include <fcntl.h>
+#include <immintrin.h>
 #include <omp.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef FPZLIB
+#include <zlib.h>
+#endif  // FPZLIB
 
 #include <algorithm>
-#include <array>
+#include <atomic>
 #include <cassert>
+#include <climits>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <queue>
-#include <sstream>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -22,69 +37,52 @@
 #define DEBUG_MSG(str)
 #endif  // DEBUG
 
-#ifdef TIMING
-#include <ctime>
-#define TIMING_START(arg)          \
-    struct timespec __start_##arg; \
-    clock_gettime(CLOCK_MONOTONIC, &__start_##arg);
-#define TIMING_END(arg)                                                                       \
-    {                                                                                         \
-        struct timespec __temp_##arg, __end_##arg;                                            \
-        double __duration_##arg;                                                              \
-        clock_gettime(CLOCK_MONOTONIC, &__end_##arg);                                         \
-        if ((__end_##arg.tv_nsec - __start_##arg.tv_nsec) < 0) {                              \
-            __temp_##arg.tv_sec = __end_##arg.tv_sec - __start_##arg.tv_sec - 1;              \
-            __temp_##arg.tv_nsec = 1000000000 + __end_##arg.tv_nsec - __start_##arg.tv_nsec;  \
-        } else {                                                                              \
-            __temp_##arg.tv_sec = __end_##arg.tv_sec - __start_##arg.tv_sec;                  \
-            __temp_##arg.tv_nsec = __end_##arg.tv_nsec - __start_##arg.tv_nsec;               \
-        }                                                                                     \
-        __duration_##arg = __temp_##arg.tv_sec + (double)__temp_##arg.tv_nsec / 1000000000.0; \
-        std::cout << #arg << " took " << __duration_##arg << "s.\n";                          \
-        std::cout.flush();                                                                    \
-    }
-#define TIMING_INIT(arg) \
-    double __duration_##arg = 0;
-#define TIMING_ACCUM(arg)                                                                      \
-    {                                                                                          \
-        struct timespec __temp_##arg, __end_##arg;                                             \
-        clock_gettime(CLOCK_MONOTONIC, &__end_##arg);                                          \
-        if ((__end_##arg.tv_nsec - __start_##arg.tv_nsec) < 0) {                               \
-            __temp_##arg.tv_sec = __end_##arg.tv_sec - __start_##arg.tv_sec - 1;               \
-            __temp_##arg.tv_nsec = 1000000000 + __end_##arg.tv_nsec - __start_##arg.tv_nsec;   \
-        } else {                                                                               \
-            __temp_##arg.tv_sec = __end_##arg.tv_sec - __start_##arg.tv_sec;                   \
-            __temp_##arg.tv_nsec = __end_##arg.tv_nsec - __start_##arg.tv_nsec;                \
-        }                                                                                      \
-        __duration_##arg += __temp_##arg.tv_sec + (double)__temp_##arg.tv_nsec / 1000000000.0; \
-    }
-#define TIMING_FIN(arg)                                          \
-    std::cout << #arg << " took " << __duration_##arg << "s.\n"; \
-    std::cout.flush();
+#ifdef METRICS
+// timers count TSC ticks, converted to seconds when metrics are dumped
+#define METRICS_START(arg) uint64_t __start_##arg = __rdtsc();
+#define METRICS_ACCUM(arg, counter) ((counter) += __rdtsc() - __start_##arg)
+#define METRICS_PHASE(arg) metrics.phases.emplace_back(#arg, __rdtsc() - __start_##arg);
+#define METRICS_ADD(counter, n) ((counter) += (n))
 #else
-#define TIMING_START(arg)
-#define TIMING_END(arg)
-#define TIMING_INIT(arg)
-#define TIMING_ACCUM(arg)
-#define TIMING_FIN(arg)
-#endif  // TIMING
-
-#define MAXFREQ 20000000
-#define MAXTRXNS 100000
-#define MAXTRXN 200
-#define MAXITEM 1000
+#define METRICS_START(arg)
+#define METRICS_ACCUM(arg, counter) ((void)0)
+#define METRICS_PHASE(arg)
+#define METRICS_ADD(counter, n) ((void)0)
+#endif  // METRICS
+
 // since 8700k has 250KB L2 cache per core
 #define MAXOSSBUF (256 * 1024)
 // // since 13400 has 9.5MB L2 cache per core
 // #define MAXOSSBUF (9 * 1024 * 1024)
-// set maximum threads available
-#define NCPUS 64
-#define REFINC(_ref) [&](int x, int y) { \
-    if (_ref[x] != _ref[y])              \
-        return _ref[x] < _ref[y];        \
-    else                                 \
-        return x > y;                    \
-}
+// conditional trees deeper than this are mined inside the parent task
+#define MAXTASKDEPTH 4
+// single paths shorter than this are enumerated inside the parent task
+#define MINTASKPATH 12
+// size of arena chunks, chunks are recycled between trees instead of freed
+#define ARENACHUNK (64 * 1024)
+// input smaller than this per thread is parsed by less threads
+#define MINPARSECHUNK (1024 * 1024)
+// maximum number of support counts with cached strings
+#define MAXSUPCACHE (1 << 22)
+// output buffers owned by each thread, a thread waits for the writer thread once all are full
+#define MAXOUTBUFS 4
+// auto engine uses tidsets when frequent items set at least one bit per 64 transactions on average
+#define MINBITSETDENSITY (1.0 / 64)
+// and only if tidsets of all frequent items fit in this many bytes
+#define MAXBITSETBYTES ((size_t)1 << 30)
+// tree budget of --stream in MB when none is given
+#define STREAMBUDGET 1024
+// bytes read at once when streaming the input
+#define STREAMCHUNK (1024 * 1024)
+// partitions of frequent ranks once a streamed tree exceeds its budget
+#define STREAMPARTS 64
+// output held back for earlier segments beyond this many bytes is spilled in deterministic mode
+#define MAXHELDBYTES ((size_t)256 << 20)
+// long single paths are split into this many tasks in deterministic mode, whatever the thread count
+#define DETERMINISTICTASKS 64
+// item ids below this are looked up in arrays indexed by id, larger ones in hash maps
+#define DENSEIDS (1 << 20)
+#define PATTERNMAGIC "FPPAT1\0\0"
 #define REFDEC(_ref) [&](int x, int y) { \
     if (_ref[x] != _ref[y])              \
         return _ref[x] > _ref[y];        \
@@ -92,115 +90,1127 @@
         return x < y;                    \
 }
 
+// Inside trees, items are dense ranks decreasing by frequency, original ids are only used for output
 using Item = int;
 using Transaction = std::vector<Item>;
+// All transactions in one array, items of transaction i are items[offsets[i], offsets[i + 1])
+struct Transactions {
+    std::vector<size_t> offsets{0};
+    std::vector<Item> items;
+
+    size_t size() const {
+        return offsets.size() - 1;
+    }
+    Item* begin(size_t i) {
+        return items.data() + offsets[i];
+    }
+    const Item* begin(size_t i) const {
+        return items.data() + offsets[i];
+    }
+    Item* end(size_t i) {
+        return items.data() + offsets[i + 1];
+    }
+    const Item* end(size_t i) const {
+        return items.data() + offsets[i + 1];
+    }
+};
+
+// Values of original item ids, any 32 bit id, so one huge id costs an entry instead of an array up to it
+template <typename T>
+struct IdMap {
+    std::vector<T> dense;                     // ids below DENSEIDS, or every id when filled directly
+    std::unordered_map<uint32_t, T> sparse;  // other ids
+    T missing;                                // value of ids never set
+
+    IdMap(T missing = T()) : missing(missing) {}
+    T& operator[](const uint32_t& id) {
+        if (id < dense.size())
+            return dense[id];
+        if (id >= DENSEIDS)
+            return sparse.try_emplace(id, missing).first->second;
+        dense.resize(id + 1, missing);
+        return dense[id];
+    }
+    T get(const uint32_t& id) const {
+        if (id < dense.size())
+            return dense[id];
+        auto it = sparse.find(id);
+        return it != sparse.end() ? it->second : missing;
+    }
+    // Call fn(id, value) for every dense id and every sparse id, sparse ones in no particular order
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (uint32_t id = 0; id < dense.size(); id++)
+            fn(id, dense[id]);
+        for (auto& [id, value] : sparse)
+            fn(id, value);
+    }
+};
+// Order of ranks, decreasing by frequency then increasing by id, pairs are frequency and id
+inline bool rank_order(const std::pair<int, uint32_t>& x, const std::pair<int, uint32_t>& y) {
+    return x.first != y.first ? x.first > y.first : x.second < y.second;
+}
+
+// Bump allocator owned by a tree, everything is released at once when the tree is destroyed
+struct Arena {
+    char* head;  // newest chunk, each chunk starts with pointer to the previous one
+    char* curr;
+    char* end;
+    size_t n_bytes;  // bytes handed out
+    size_t n_nodes;  // objects constructed by make
+
+    Arena() : head(NULL), curr(NULL), end(NULL), n_bytes(0), n_nodes(0) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() {
+        reset();
+    }
+
+    void* allocate(size_t size, size_t align);
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        n_nodes++;
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    // Return all chunks to the chunk pool of current thread, destructors are not called
+    void reset();
+};
+// Chunks released by arenas on this thread, linked through their first pointer
+struct ChunkPool {
+    char* head = NULL;
+    ~ChunkPool() {
+        while (head != NULL) {
+            char* prev = *(char**)head;
+            free(head);
+            head = prev;
+        }
+    }
+};
+// Allocation counters of all destroyed arenas during a mining run
+struct ArenaStats {
+    std::atomic<size_t> n_bytes{0};
+    std::atomic<size_t> n_nodes{0};
+    std::atomic<size_t> n_chunks{0};  // chunks taken from malloc instead of the pool
+};
+thread_local ChunkPool chunk_pool;
+ArenaStats arena_stats;
+
+// Counters of one recursion depth of FPTree::fpgrowth, the depth of a tree is the size of its base
+struct DepthMetrics {
+    uint64_t n_trees = 0;         // conditional trees built
+    uint64_t n_nodes = 0;         // nodes allocated by them
+    uint64_t n_single_paths = 0;  // trees mined as combinations of a single path
+    uint64_t n_bases = 0;         // bases of conditional trees written as patterns
+    uint64_t growth_ticks = 0;    // building conditional trees
+};
+// Counters of one OpenMP thread
+struct alignas(64) ThreadMetrics {
+    std::vector<DepthMetrics> depths;
+    uint64_t n_patterns = 0;     // patterns passed to the writer of lowest support, or counted in OUTPUT_COUNT mode
+    uint64_t n_bytes = 0;        // bytes of formatted lines
+    uint64_t format_ticks = 0;   // formatting and buffering patterns, including blocked_ticks
+    uint64_t blocked_ticks = 0;  // waiting for a free output buffer
+
+    DepthMetrics& depth(size_t d) {
+        if (d >= depths.size())
+            depths.resize(d + 1);
+        return depths[d];
+    }
+};
+// Counters of a run, only collected in METRICS builds and dumped as JSON at exit
+struct Metrics {
+    std::vector<ThreadMetrics> threads;                    // one per OpenMP thread
+    std::vector<std::pair<std::string, uint64_t>> phases;  // ticks of each phase of main, in order
+    uint64_t n_written = 0;                                // bytes written by writer threads
+    uint64_t io_ticks = 0;                                 // writer threads in write calls
+    uint64_t start_ticks;                                  // ticks and seconds at start, to convert ticks
+    double start_time;
+
+    Metrics();
+    ThreadMetrics& local() {
+        return threads[omp_get_thread_num()];
+    }
+    // Write JSON to filename
+    bool dump(const std::string& filename) const;
+};
+Metrics metrics;
+
+// Allocator for std containers inside arena allocated nodes, deallocation is left to the arena
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+    Arena* arena;
+
+    ArenaAllocator(Arena* arena) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return (T*)arena->allocate(n * sizeof(T), alignof(T));
+    }
+    void deallocate(T*, size_t) {}
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+};
+
+// Children stored in an ordered map, about 48 bytes per node plus a map node per child
+template <typename Node>
+struct MapChildren {
+    std::map<Item, Node*, std::less<Item>, ArenaAllocator<std::pair<const Item, Node*>>> map;
+
+    MapChildren(Arena& arena) : map(ArenaAllocator<Node*>(&arena)) {}
+
+    Node* find(Item item) {
+        auto it = map.find(item);
+        return it != map.end() ? it->second : NULL;
+    }
+    void add(Node* node) {
+        map.emplace(node->item, node);
+    }
+    bool empty() const {
+        return map.empty();
+    }
+    template <typename Func>
+    void forEach(Func func) const {
+        for (auto& pair : map)
+            func(pair.second);
+    }
+};
+// Children linked by first child and next sibling, 16 bytes per node
+// found child is moved to front, so frequent branches are matched first
+template <typename Node>
+struct SiblingChildren {
+    Node* first;    // first child of this node
+    Node* sibling;  // next child of the parent of this node
+
+    SiblingChildren(Arena&) : first(NULL), sibling(NULL) {}
+
+    Node* find(Item item) {
+        Node* prev = NULL;
+        for (Node* curr = first; curr != NULL; prev = curr, curr = curr->child.sibling) {
+            if (curr->item == item) {
+                if (prev != NULL) {
+                    prev->child.sibling = curr->child.sibling;
+                    curr->child.sibling = first;
+                    first = curr;
+                }
+                return curr;
+            }
+        }
+        return NULL;
+    }
+    void add(Node* node) {
+        node->child.sibling = first;
+        first = node;
+    }
+    bool empty() const {
+        return first == NULL;
+    }
+    template <typename Func>
+    void forEach(Func func) const {
+        for (Node* curr = first; curr != NULL; curr = curr->child.sibling)
+            func(curr);
+    }
+};
 
-struct FPNode {
+template <template <typename> class Children>
+struct BasicFPNode {
     // Metadata
     Item item;
     int cnt;
     // link list data (same item)
-    FPNode* next;
+    BasicFPNode* next;
     // tree data
-    FPNode* parent;
-    std::map<Item, FPNode*> child;
+    BasicFPNode* parent;
+    Children<BasicFPNode> child;
+
+    BasicFPNode(Item item, Arena& arena) : item(item), cnt(0), next(NULL), parent(NULL), child(arena) {}
+};
+// select child container at compile time, see bench_child.sh
+#ifdef FPCHILD_MAP
+using FPNode = BasicFPNode<MapChildren>;
+#else
+using FPNode = BasicFPNode<SiblingChildren>;
+#endif  // FPCHILD_MAP
+
+// Unlinked temporary file of spilled transactions, each record is a length followed by ranks,
+// or of spilled output lines read back with pread
+struct SpillFile {
+    FILE* file = NULL;
 
-    FPNode(Item item) : item(item), cnt(0), next(NULL), parent(NULL) {}
+    SpillFile() {}
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+    ~SpillFile() {
+        if (file != NULL)
+            fclose(file);
+    }
+
+    // Create the file in $TMPDIR, or /tmp
+    bool open();
+    void write(const Item* begin, const Item* end);
+    // Call fn with each transaction written so far, then close the file, false on I/O error
+    template <typename Fn>
+    bool drain(Fn fn);
+};
+
+// Raw buffer of formatted output lines
+struct OutBuf {
+    char* data;
+    size_t size;
+    size_t cap;
+    OutBuf* next;  // link in the writer queue or free list
+    int owner;     // thread the buffer is returned to
+    off_t spilled = -1;  // offset of the lines in the spill file of the writer, data is NULL then
+
+    OutBuf(int owner) : data(NULL), size(0), cap(0), next(NULL), owner(owner) {}
+    OutBuf(const OutBuf&) = delete;
+    OutBuf& operator=(const OutBuf&) = delete;
+    ~OutBuf() {
+        free(data);
+    }
+
+    // Return end of buffer with room for at least n more bytes
+    char* reserve(size_t n) {
+        if (size + n > cap) {
+            cap = std::max(size + n, std::max(cap * 2, (size_t)MAXOSSBUF + 4096));
+            data = (char*)realloc(data, cap);
+        }
+        return data + size;
+    }
+};
+
+// Output of one deferred task in deterministic mode, sealed buffers and segments of the tasks it
+// spawned in program order, written once every segment before it is written
+struct Segment {
+    std::vector<std::pair<OutBuf*, Segment*>> pieces;  // a buffer, or a child segment if the buffer is NULL
+    Segment* higher = NULL;  // segment of the same task in the writer of next higher support
+    Segment* saved = NULL;   // segment of the thread before entering this one
+    bool done = false;       // no more pieces are added
+};
+
+// Output of one thread, full buffers go to the writer thread and come back through free_bufs
+struct alignas(64) OutStream {
+    OutBuf* buf = NULL;                     // buffer being filled
+    Segment* seg = NULL;                    // segment buf belongs to in deterministic mode, NULL is the root
+    std::string prev;                       // pattern bytes of the last binary record in buf, the next one is delta encoded
+    std::string record;                     // pattern bytes of the binary record being written
+    OutBuf* spare = NULL;                   // free buffers taken by this thread
+    std::atomic<OutBuf*> free_bufs{NULL};   // buffers returned by the writer thread
+    std::vector<std::unique_ptr<OutBuf>> owned;
+    uint64_t n_patterns = 0;                     // patterns counted in OUTPUT_COUNT mode
+    std::vector<std::pair<int, std::string>> top;  // min heap of support and ",{item}" line in OUTPUT_TOPK mode
+    std::vector<std::pair<int, Transaction>> cands;  // support and sorted items of candidates in OUTPUT_CLOSED and OUTPUT_MAXIMAL modes
+};
+enum OutputMode {
+    OUTPUT_PATTERNS,  // every pattern
+    OUTPUT_COUNT,     // number of patterns only
+    OUTPUT_TOPK,      // K patterns of highest support, ties are broken arbitrarily
+    OUTPUT_CLOSED,    // patterns without a superset of the same support
+    OUTPUT_MAXIMAL,   // patterns without a frequent superset
+};
+
+// Formats patterns into per-thread buffers, a dedicated thread writes full buffers to the output file
+struct PatternWriter {
+    int fd;
+    std::vector<OutStream> outs;        // one stream per thread
+    const std::vector<Item>& item_ids;  // original id of each rank
+    size_t trxns_size;
+    int min_sup;
+    std::vector<uint64_t> sup_strs;  // ":{support}\n" of each support count from min_sup, exactly 8 bytes
+
+    // lock free stack of full buffers, the writer thread takes all at once
+    std::atomic<OutBuf*> full_bufs{NULL};
+    OutBuf stop;  // pushed last to end the writer thread
+    std::thread io_thread;
+    size_t n_written;   // bytes written by the writer thread
+    uint64_t io_ticks;  // ticks the writer thread spent in write calls
+
+    OutputMode mode = OUTPUT_PATTERNS;
+    int top_k = 0;
+    std::atomic<int> top_min{0};  // smallest support in a full heap, a pattern not above it can not be in top K
+    PatternWriter* higher = NULL;  // writer of the next higher support in a sweep, gets patterns meeting its support
+
+    bool binary = false;      // binary records instead of text lines, see writeHeader
+    bool compressed = false;  // binary buffers are compressed into blocks, needs FPZLIB
+    bool deterministic = false;  // same output whatever the thread count and scheduling
+    Segment root;                // output outside of any forked task
+    std::mutex seg_mutex;        // guards pieces and done of segments and the cursor
+    std::vector<std::pair<Segment*, size_t>> cursor;  // next piece to submit of each segment on the path from root
+    size_t n_held = 0;           // bytes of sealed pieces not submitted yet
+    SpillFile spill;             // pieces beyond MAXHELDBYTES, written by the writer thread from there
+    off_t spill_end = 0;
+
+    // Writer for parallel regions of at most n_threads threads
+    PatternWriter(const std::string& output_filename, const std::vector<Item>& item_ids, const int& min_sup, const size_t& trxns_size, const int& n_threads);
+    ~PatternWriter();
+
+    bool is_open() {
+        return fd >= 0;
+    }
+    // Stream of the thread running current task
+    OutStream& local() {
+        assert(omp_get_thread_num() < (int)outs.size());
+        return outs[omp_get_thread_num()];
+    }
+    // Append line "{items}{suffix}:{support}", suffix is either empty or starts with comma
+    // in OUTPUT_COUNT and OUTPUT_TOPK modes the pattern is only counted or kept in the heap of out,
+    // in OUTPUT_CLOSED and OUTPUT_MAXIMAL modes it is kept as a candidate and suffix must be empty
+    void write(OutStream& out, const Item* items, size_t n_items, const std::string& suffix, const int& cnt);
+    // write without passing the pattern on to higher writers
+    void writeOwn(OutStream& out, const Item* items, size_t n_items, const std::string& suffix, const int& cnt);
+    // Append line "{items}{suffix}:{support}" regardless of mode
+    void writePattern(OutStream& out, const Item* items, size_t n_items, const std::string& suffix, const int& cnt);
+    // Add n patterns in OUTPUT_COUNT mode, saturates at UINT64_MAX
+    void count(OutStream& out, const uint64_t& n) {
+        out.n_patterns = n > UINT64_MAX - out.n_patterns ? UINT64_MAX : out.n_patterns + n;
+    }
+    // Patterns of support cnt and their extensions can not be in top K
+    // in deterministic mode ties of the smallest support are kept, so the heap order decides them
+    bool pruned(const int& cnt) {
+        int bound = top_min.load(std::memory_order_relaxed);
+        return mode == OUTPUT_TOPK && (cnt < bound || (cnt == bound && !deterministic));
+    }
+    // Patterns are kept in segments of tasks while mining
+    bool segmented() {
+        return deterministic && mode == OUTPUT_PATTERNS;
+    }
+    // Seal the buffer of out and add a segment for a task about to be deferred, NULL unless segmented
+    // the task runs inside it with SegmentScope, segments are written in the order they were forked
+    Segment* fork(OutStream& out);
+    // Direct output of the running thread to seg and its higher segments, and back to the previous ones
+    void enter(Segment* seg);
+    void leave(Segment* seg);
+    // Move filled part of the buffer of out to its segment, small parts are copied so the buffer is reused
+    void seal(OutStream& out, const int& owner);
+    // Submit pieces in order up to the first segment not done, seg_mutex must be held
+    void drain();
+    // Only closed patterns are needed, so items in every transaction of a pattern can be merged into it
+    bool closedOnly() {
+        return mode == OUTPUT_CLOSED || mode == OUTPUT_MAXIMAL;
+    }
+    // Append line "{str}{suffix}{sup_str}" of items and support count cnt, str is formatted with its leading comma
+    void writeLine(OutStream& out, const char* str, size_t len, const std::string& suffix, const int& cnt, const uint64_t& sup_str);
+    // Copy formatted line of support cnt to the writers of higher support it meets
+    void forward(OutStream& out, const char* line, size_t len, const int& cnt);
+    // Append ",{item}" of each item to str, or the varint rank of each item in binary mode
+    void format(std::string& str, const Item* items, size_t n_items);
+    // Write the binary header, before any pattern is written
+    // header is PATTERNMAGIC, u32 flags (1 if compressed), u32 number of ranks, u64 transactions and u32 item id of each rank
+    void writeHeader();
+    // Append binary record of pattern bytes out.record of support count cnt to out and to the writers of higher support it meets
+    // record is varint bytes shared with the previous pattern of the buffer, varint length and the other bytes, varint cnt
+    void writeRecord(OutStream& out, const int& cnt);
+    // Replace the content of buf by a block of u32 raw length, u32 compressed length and deflate data
+    void compress(OutBuf* buf);
+    // Hand buffer to the writer thread once it exceeds MAXOSSBUF
+    void flush(OutStream& out);
+    // Same as printing (double)cnt / trxns_size with std::fixed and std::setprecision(4)
+    uint64_t formatSupport(const int& cnt);
+    // Cached formatSupport of support count
+    uint64_t supportString(const int& cnt) {
+        return cnt - min_sup < (int)sup_strs.size() ? sup_strs[cnt - min_sup] : formatSupport(cnt);
+    }
+
+    // Take a free buffer of the stream, waits if all of its buffers are queued unless segmented
+    OutBuf* acquire(OutStream& out, int owner);
+    void submit(OutBuf* buf);
+    // Writer thread, writes queued buffers in order and returns them to their owners
+    void ioLoop();
+    // Write all of iov to the output file and clear it
+    void writeIov(std::vector<struct iovec>& iov);
+    // Copy lines of a spilled piece from the spill file to the output file
+    void copySpilled(const OutBuf* buf, std::vector<char>& chunk);
+    // Write total count, merged top K lines or candidates without a superset in place of patterns
+    void summarize();
+    // Drop candidates with a superset, of the same support in OUTPUT_CLOSED mode
+    void filterCandidates(std::vector<std::pair<int, Transaction>>& cands);
+    // Submit remaining buffers and wait for the writer thread
+    void close();
+};
+
+// Runs the enclosing task in seg of writer, nothing if seg is NULL
+struct SegmentScope {
+    PatternWriter& writer;
+    Segment* seg;
+
+    SegmentScope(PatternWriter& writer, Segment* seg) : writer(writer), seg(seg) {
+        if (seg != NULL)
+            writer.enter(seg);
+    }
+    ~SegmentScope() {
+        if (seg != NULL)
+            writer.leave(seg);
+    }
+};
+
+// Single path laid out for enumeration, position i is the i-th item of items_by_freq
+struct SinglePath {
+    std::string strs;                   // formatted item of every position, concatenated
+    std::vector<uint32_t> str_offsets;  // strs of position i is [str_offsets[i], str_offsets[i + 1])
+    std::vector<int> cnts;              // support count of a combination ending at position i
+    std::vector<uint64_t> sup_strs;     // support string of a combination ending at position i
+    std::string suffix;                 // formatted base of the conditional tree
+
+    size_t size() const {
+        return sup_strs.size();
+    }
+};
+
+// Write value as LEB128 varint, return end of written bytes
+inline char* write_varint(char* ptr, uint32_t value) {
+    while (value >= 0x80) {
+        *ptr++ = (char)(value | 0x80);
+        value >>= 7;
+    }
+    *ptr++ = (char)value;
+    return ptr;
+}
+
+// Write decimal digits of value, return end of written digits
+inline char* write_uint(char* ptr, uint32_t value) {
+    char tmp[10];
+    int len = 0;
+    do {
+        tmp[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    while (len > 0)
+        *ptr++ = tmp[--len];
+    return ptr;
+}
+
+// Read only FP-tree as arrays, nodes are numbered in DFS order so prefix paths walk towards the front
+// node 0 is the root, it also terminates header chains
+// arrays are one block of 32 bit words, either owned or mapped from a snapshot
+struct FrozenTree {
+    using Node = uint32_t;
+    size_t n_nodes = 0;
+    size_t n_heads = 0;
+    const Item* items = NULL;
+    const int* cnts = NULL;
+    const Node* parents = NULL;
+    const Node* nexts = NULL;       // next node of the same item
+    const Node* heads = NULL;       // first node of each item
+    std::vector<uint32_t> storage;  // block built by FPTree::freeze, empty when mapped
+
+    size_t size() const {
+        return n_nodes;
+    }
+    // Words of the block, items, cnts, parents, nexts of n_nodes each, then heads of n_heads
+    size_t words() const {
+        return 4 * n_nodes + n_heads;
+    }
+    const uint32_t* data() const {
+        return (const uint32_t*)items;
+    }
+    // Point arrays into block laid out as described by words
+    void attach(const uint32_t* block, size_t n_nodes, size_t n_heads) {
+        this->n_nodes = n_nodes;
+        this->n_heads = n_heads;
+        items = (const Item*)block;
+        cnts = (const int*)block + n_nodes;
+        parents = block + 2 * n_nodes;
+        nexts = block + 3 * n_nodes;
+        heads = block + 4 * n_nodes;
+    }
+
+    // Node access shared with FPTree, see FPTree::growth
+    Node first(const Item& item) const {
+        return heads[item];
+    }
+    Node next(const Node& node) const {
+        return nexts[node];
+    }
+    Node parent(const Node& node) const {
+        return parents[node];
+    }
+    bool valid(const Node& node) const {
+        return node != 0;
+    }
+    Item item(const Node& node) const {
+        return items[node];
+    }
+    int cnt(const Node& node) const {
+        return cnts[node];
+    }
 };
+
 struct FPTree {
+    Arena arena;  // owns every node of the tree
     FPNode* root;
-    std::unordered_map<Item, FPNode*> hdr_table;
-    std::vector<Item> items_by_freq;          // items above minimum support, sorts decreasing by frequency
-    std::unordered_map<Item, int> item_freq;  // item frequency count
+    std::vector<FPNode*> hdr_table;
+    std::vector<Item> items_by_freq;  // items above minimum support, sorts decreasing by frequency
+    std::vector<int> item_freq;       // item frequency count
+    const std::vector<Item>& item_ids;  // original id of each rank
+    FrozenTree frozen;                  // array layout after freeze, replaces the nodes
+    Transaction merged;                 // items merged into base by growth
     bool singlePath;
 
-    FPTree() {
-        root = new FPNode(-1);
+    // Tree of items with rank less than n_items
+    FPTree(int n_items, const std::vector<Item>& item_ids) : hdr_table(n_items, NULL), item_freq(n_items, 0), item_ids(item_ids) {
+        root = arena.make<FPNode>(-1, arena);
         singlePath = true;
     }
     ~FPTree() {
-        deleteTree(root);
+        arena_stats.n_bytes += arena.n_bytes;
+        arena_stats.n_nodes += arena.n_nodes;
     };
 
-    void insertPath(const Transaction& trxn, std::unordered_map<Item, FPNode*>& tail_table, const int& inc);
-    void buildFromTrxns(const std::vector<Transaction>& trxns, const int& min_sup);
-    void fpgrowthCombinationThread(int idx, std::vector<Item>& lst, std::string&& base_str, std::ofstream& output_file, size_t trxns_size, std::ostringstream& oss);
-    void fpgrowthCombination(std::string&& base_str, std::ofstream& output_file, const size_t& trxns_size, std::array<std::ostringstream, NCPUS>& oss_arr, const int& n_cpus);
-    void growth(FPNode* preroot, FPNode* prehead, const int& min_sup);
-    void fpgrowth(const std::string& output_filename, const int& min_sup, const size_t& trxns_size, const int& n_cpus);
-    void fpgrowth(Transaction& base, const int& min_sup, std::ofstream& output_file, const size_t& trxns_size, std::array<std::ostringstream, NCPUS>& oss_arr, std::ostringstream& base_oss, const int& n_cpus);
+    // Insert items of path from root side, path is sorted increasing by rank
+    void insertPath(const Item* path, const Item* path_end, std::vector<FPNode*>& tail_table, const int& inc);
+    // Frequency of every rank in the tree, items_by_freq keeps ranks of at least min_sup
+    void countRanks(const std::vector<int>& rank_freq, const int& min_sup);
+    // Build from transactions sorted by rank, ranks out of the tree are pruned
+    void buildFromTrxns(const Transactions& trxns, const std::vector<int>& rank_freq, const int& min_sup);
+    // Move nodes into frozen and release them, conditional trees are then grown from the arrays
+    void freeze();
+    // Use frozen block of a tree built at a lower or equal support, see FrozenTree::words
+    void buildFromFrozen(const uint32_t* block, size_t n_nodes, size_t n_heads, bool single_path, const std::vector<int>& rank_freq, const int& min_sup);
+    // Turn frozen back into nodes and insert transactions from first on, call freeze afterwards
+    void appendTrxns(const Transactions& trxns, size_t first);
+    // Enumerate combinations of single path from idx, prefix holds ",{item}" of chosen items
+    void fpgrowthCombinationThread(int idx, std::string& prefix, const SinglePath& path, PatternWriter& writer, OutStream& out);
+    void fpgrowthCombination(const Transaction& base, PatternWriter& writer, const int& n_cpus);
+    // Build conditional tree of base_item from prefix paths in tree, either an FPTree or a FrozenTree
+    // with merge, items in every prefix path are moved to merged instead of the tree
+    template <typename Tree>
+    void growth(const Tree& tree, const Item& base_item, const int& min_sup, const bool& merge);
+    // Mine all frequent patterns into writer with n_cpus threads
+    void fpgrowth(PatternWriter& writer, const int& min_sup, const int& n_cpus);
+    // Mine conditional trees of every item, each as an omp task, must be called inside a parallel region
+    void fpgrowth(const Transaction& base, const int& min_sup, PatternWriter& writer, const int& n_cpus);
 
     bool empty();
     bool hasSinglePath();
+
+    // Mine only suffix items of rank lo or more, lower ranks are mined from another partition
+    void keepSuffixes(const Item& lo);
+
+    // Node access shared with FrozenTree
+    using Node = const FPNode*;
+    Node first(const Item& item) const {
+        return hdr_table[item];
+    }
+    Node next(const Node& node) const {
+        return node->next;
+    }
+    Node parent(const Node& node) const {
+        return node->parent;
+    }
+    bool valid(const Node& node) const {
+        return node != NULL && node != root;
+    }
+    Item item(const Node& node) const {
+        return node->item;
+    }
+    int cnt(const Node& node) const {
+        return node->cnt;
+    }
     // Debug use, output traverse of fptree
     void traverse(FPNode* node);
-    // Delete subtree from node
-    void deleteTree(FPNode* node);
 };
 
-// Read transactions from file and count item frequencies
-void read_transactions(const std::string& input_filename, std::vector<Transaction>& trxns, FPTree& fptree);
-void reset_oss(std::ostringstream& oss) {
-    oss.clear();
-    oss.str("");
-}
+// Conditional database stored as flat rows instead of a tree, each row is a prefix path with a count
+struct ProjDB {
+    std::vector<Item> items;     // items of all rows, each row sorted increasing by rank
+    std::vector<size_t> offsets;  // row r is items[offsets[r], offsets[r + 1])
+    std::vector<int> cnts;        // count of each row
+    std::vector<int> item_freq;   // frequency of each item, counted while the rows are projected
+    // occurrences of each item, occurrences of item i are [occ_offsets[i], occ_offsets[i + 1])
+    std::vector<size_t> occ_offsets;
+    std::vector<size_t> occ_rows;
+    std::vector<size_t> occ_pos;  // position of the item in items, its prefix starts at offsets[row]
+
+    // Database of items with rank less than n_items
+    ProjDB(int n_items) : offsets{0}, item_freq(n_items, 0) {}
+
+    size_t size() const {
+        return cnts.size();
+    }
+    // Rows of transactions sorted by rank, ranks out of the database are pruned
+    void buildFromTrxns(const Transactions& trxns);
+    // Rows of parent containing item, cut before item, infrequent items of parent are dropped
+    void project(const ProjDB& parent, const Item& item, const int& min_sup);
+    // Build occurrence lists of frequent items
+    void index(const int& min_sup);
+    // Mine all frequent patterns into writer with n_cpus threads
+    void projgrowth(PatternWriter& writer, const int& min_sup, const int& n_cpus);
+    // Mine projected database of every frequent item, each as an omp task
+    void projgrowth(const Transaction& base, const int& min_sup, PatternWriter& writer);
+};
+
+// Mining engine selected by --engine
+// Write a & b of n_words words to out, return number of set bits of out
+using AndCountFunc = int (*)(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n_words);
+int and_count(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n_words);
+int and_count_avx2(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n_words);
+
+// Vertical database, one bitset of transaction ids (tidset) per item
+struct BitsetDB {
+    size_t n_words;              // 64 bit words of each tidset
+    std::unique_ptr<uint64_t[]> sets;  // tidset of item i is sets[i * n_words, (i + 1) * n_words)
+    std::vector<int> item_freq;  // frequency of each item
+    AndCountFunc and_count_fn;   // intersection kernel selected for the cpu
+
+    // Database of items with rank less than n_items over n_trxns transactions
+    BitsetDB(int n_items, size_t n_trxns) : n_words((n_trxns + 63) / 64), item_freq(n_items, 0) {
+        and_count_fn = __builtin_cpu_supports("avx2") ? and_count_avx2 : and_count;
+    }
+
+    // Bytes of tidsets of n_items items over n_trxns transactions
+    static size_t bytes(int n_items, size_t n_trxns) {
+        return (n_trxns + 63) / 64 * 8 * n_items;
+    }
+    // Set bits of transactions sorted by rank, ranks out of the database are pruned
+    void buildFromTrxns(const Transactions& trxns, const std::vector<int>& rank_freq, const int& n_cpus);
+    // Mine all frequent patterns into writer with n_cpus threads
+    void eclat(PatternWriter& writer, const int& min_sup, const int& n_cpus);
+    // Mine extensions of base by the n frequent items of its class, each item has its tidset in class_sets
+    // and its support in sups, each extension is an omp task
+    void eclat(const Transaction& base, const Item* items, const int* sups, const uint64_t* class_sets, size_t n, const int& min_sup, PatternWriter& writer);
+};
+// Header of a binary snapshot, sections follow in order, each padded to 8 bytes:
+// item_ids and rank_freq of n_ranks, offsets of n_trxns + 1, items of n_occurs, then the frozen tree block
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t n_trxns;
+    uint64_t n_ranks;
+    uint64_t n_occurs;
+    uint64_t floor;    // support count the tree was built at
+    uint64_t n_nodes;  // nodes of the frozen tree, 0 without tree
+    uint64_t n_heads;
+    uint64_t single_path;
+    uint64_t ranked;  // ranks are decreasing by frequency, false after appending keeps the old order
+};
+#define SNAPSHOTMAGIC "FPSNAP2"
+// Read only mapping of a snapshot file, transactions are remapped to ranks and sorted
+struct Snapshot {
+    const char* data = NULL;
+    size_t size = 0;
+    const SnapshotHeader* hdr = NULL;
+    const Item* item_ids = NULL;
+    const int* rank_freq = NULL;
+    const uint64_t* offsets = NULL;
+    const Item* items = NULL;
+    const uint32_t* tree_block = NULL;
+
+    Snapshot() {}
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot() {
+        if (data != NULL)
+            munmap((void*)data, size);
+    }
+
+    // File starts with the snapshot magic
+    static bool isSnapshot(const std::string& filename);
+    // Map file, false if it can not be read or is truncated
+    bool open(const std::string& filename);
+    // Copy original id and frequency of each rank
+    void loadRanks(std::vector<Item>& item_ids, std::vector<int>& rank_freq) const;
+    // Copy transactions, only needed when the tree of the snapshot is not used
+    void loadTrxns(Transactions& trxns) const;
+    // Frozen tree block if one was built at a support count of at most min_sup, NULL otherwise
+    // only a ranked tree can be used, pruned ranks of a tree must be a suffix
+    const uint32_t* tree(const int& min_sup) const {
+        return hdr->n_nodes > 0 && hdr->ranked && hdr->floor <= (uint64_t)std::max(min_sup, 1) ? tree_block : NULL;
+    }
+    // Frozen tree block if it holds every rank, in any order, NULL otherwise
+    const uint32_t* fullTree() const {
+        return hdr->n_nodes > 0 && hdr->floor <= 1 ? tree_block : NULL;
+    }
+};
+// Write remapped transactions, and tree if not NULL as built at support count floor
+bool save_snapshot(const std::string& filename, const Transactions& trxns, const std::vector<Item>& item_ids, const std::vector<int>& rank_freq,
+                   const FrozenTree* tree, const int& floor, const bool& single_path);
+
+enum Engine {
+    ENGINE_TREE,    // conditional FP-trees
+    ENGINE_PROJ,    // flat projected databases
+    ENGINE_BITSET,  // tidset intersection
+    ENGINE_AUTO,    // chosen by density of the transactions
+};
+// Optional arguments after the positional ones
+struct Options {
+    Engine engine = ENGINE_AUTO;
+    OutputMode output = OUTPUT_PATTERNS;
+    int top_k = 0;
+    std::string snapshot;  // file to save a snapshot to
+    std::string append;    // transactions appended to the snapshot given as input
+    int stream = -1;       // tree budget in MB when the input is streamed, -1 loads it
+    std::string metrics;   // file to dump metrics to, none if empty
+    bool deterministic = false;  // same output whatever the thread count
+    bool binary = false;         // binary records instead of text lines
+    bool compressed = false;     // binary records in compressed blocks
+};
+// Parse "--name=value" arguments from argv[first], return false on unknown argument
+bool parse_options(int argc, char** argv, int first, Options& opts);
+// Parse comma separated supports and output files of a sweep into pairs sorted by support
+bool parse_sweep(const std::string& supports, const std::string& filenames, std::vector<std::pair<double, std::string>>& sweep);
+
+// Read transactions from file and count item frequencies, indexed by item id
+// the file is split into newline aligned chunks parsed by n_cpus threads, false if an item id does not fit 32 bits
+bool read_transactions(const std::string& input_filename, Transactions& trxns, IdMap<int>& item_freq, const int& n_cpus);
+// Parse lines in [ptr, end), append to trxns and count into item_freq, false if an item id does not fit 32 bits
+// ids are kept as the bits of a uint32_t until they are remapped to ranks
+bool parse_transactions(const char* ptr, const char* end, Transactions& trxns, IdMap<int>& item_freq);
+// Read file in chunks of STREAMCHUNK, count item_freq and call fn(begin, end) with the item ids of each line
+// until fn returns false, only one chunk of transactions is kept, false if the file can not be read or an item id does not fit 32 bits
+template <typename Fn>
+bool stream_transactions(const std::string& input_filename, IdMap<int>& item_freq, Fn fn);
+// Second pass of streaming, insert pruned transactions into a tree and mine it
+// once the tree takes more than budget bytes, transactions are spilled to partitions of ranks mined one by one
+bool stream_fpgrowth(const std::string& input_filename, const std::vector<Item>& item_ids, const std::vector<int>& rank_freq, const int& n_items,
+                     const int& min_sup, const size_t& budget, PatternWriter& writer, const int& n_cpus);
+// Replace item ids of transactions with ranks decreasing by frequency, and sort transactions by rank
+void remap_transactions(Transactions& trxns, const IdMap<int>& item_freq, std::vector<Item>& item_ids, std::vector<int>& rank_freq);
+// Append delta transactions with item frequency delta_freq to remapped trxns
+// ranks keep their order, items not seen before get new ranks after all others
+void append_transactions(Transactions& trxns, std::vector<Item>& item_ids, std::vector<int>& rank_freq, Transactions& delta, const IdMap<int>& delta_freq);
 
 int main(int argc, char** argv) {
     std::ios_base::sync_with_stdio(false);
     std::cin.tie(0);
 
-    assert(argc == 4);
-    double fmin_sup = atof(argv[1]);
+    Options opts;
+    std::vector<std::pair<double, std::string>> sweep;  // min support and output file of each run
+    if (argc < 4 || !parse_options(argc, argv, 4, opts) || !parse_sweep(argv[1], argv[3], sweep) ||
+        (sweep.size() > 1 && opts.output == OUTPUT_MAXIMAL) ||
+        ((!opts.append.empty() || opts.stream >= 0) && opts.engine != ENGINE_TREE && opts.engine != ENGINE_AUTO) ||
+        (opts.stream >= 0 && (!opts.append.empty() || !opts.snapshot.empty())) ||
+        (opts.binary && (opts.output == OUTPUT_COUNT || opts.output == OUTPUT_TOPK))) {
+        std::cerr << "usage: " << argv[0] << " {min_support[,...]} {input_filename} {output_filename[,...]} [--engine=tree|proj|bitset|auto] [--count|--top=K|--closed|--maximal] [--save-snapshot=FILE] [--append=FILE] [--stream[=MB]] [--metrics=FILE] [--deterministic] [--binary[=zlib]]\n";
+        return 1;
+    }
+    // streamed transactions are only kept in the tree
+    bool streaming = opts.stream >= 0;
+    if (streaming)
+        opts.engine = ENGINE_TREE;
+    // appended transactions are inserted into the tree of the snapshot
+    bool appending = !opts.append.empty();
+    if (appending)
+        opts.engine = ENGINE_TREE;
+    double fmin_sup = sweep[0].first;  // patterns are mined once at the lowest support
     std::string input_filename = argv[2];
-    std::string output_filename = argv[3];
-    int n_cpus = std::min(omp_get_max_threads(), NCPUS);
+    int n_cpus = omp_get_max_threads();
+    metrics.threads.resize(n_cpus);
 
     DEBUG_MSG("Cpus: " << n_cpus);
+#ifndef METRICS
+    if (!opts.metrics.empty())
+        std::cerr << "built without METRICS, --metrics is ignored\n";
+#endif  // METRICS
+#ifndef FPZLIB
+    if (opts.compressed) {
+        std::cerr << "built without FPZLIB, --binary=zlib is not available\n";
+        return 1;
+    }
+#endif  // FPZLIB
 
     int min_sup;
-    FPTree fptree;
-    std::vector<Transaction> trxns;  // transaction list
+    size_t n_trxns = 0;          // number of transactions
+    Snapshot snapshot;           // input file when it is a snapshot
+    Transactions trxns;          // transaction list
+    IdMap<int> item_freq;        // frequency of original item ids
+    std::vector<Item> item_ids;  // original id of each rank
+    std::vector<int> rank_freq;  // frequency of each rank
 
     // input
     // build trxns and item_freq
     // first scan, count freq and load transactions
-    TIMING_START(total);
-    TIMING_START(input);
-    read_transactions(input_filename, trxns, fptree);
-    min_sup = ceil(fmin_sup * trxns.size());  // transform min support percent to min support count
-    TIMING_END(input);
-
-    // construct fptree
-    // set min_sup, build fptree
-    // second scan, build fptree and update table
-    TIMING_START(build_fptree);
-    fptree.buildFromTrxns(trxns, min_sup);
-    TIMING_END(build_fptree);
-
-    // output once a pattern is found
-    TIMING_START(fpgrowth_and_output);
-    fptree.fpgrowth(output_filename, min_sup, trxns.size(), n_cpus);
-    TIMING_END(fpgrowth_and_output);
-    TIMING_END(total);
+    METRICS_START(total);
+    METRICS_START(input);
+    bool from_snapshot = !streaming && Snapshot::isSnapshot(input_filename);
+    if (streaming) {
+        // first pass only counts, lines are parsed again while building the tree
+        auto count = [&](const Item*, const Item*) { return ++n_trxns > 0; };
+        if (!stream_transactions(input_filename, item_freq, count)) {
+            std::cerr << "cannot read " << input_filename << ", or an item id does not fit 32 bits\n";
+            return 1;
+        }
+    } else if (from_snapshot) {
+        if (!snapshot.open(input_filename)) {
+            std::cerr << "invalid snapshot " << input_filename << "\n";
+            return 1;
+        }
+        // transactions are copied once it is known the tree of the snapshot can not be used instead
+        // appending to a tree of every rank only needs them to write a new snapshot
+        snapshot.loadRanks(item_ids, rank_freq);
+        n_trxns = snapshot.hdr->n_trxns;
+        if (appending ? snapshot.fullTree() == NULL || !opts.snapshot.empty() : !snapshot.hdr->ranked)
+            snapshot.loadTrxns(trxns);
+    } else if (appending) {
+        std::cerr << "--append needs a snapshot as input\n";
+        return 1;
+    } else if (!read_transactions(input_filename, trxns, item_freq, n_cpus)) {
+        std::cerr << "item id does not fit 32 bits in " << input_filename << "\n";
+        return 1;
+    }
+    if (appending) {
+        Transactions delta;
+        IdMap<int> delta_freq;
+        if (!read_transactions(opts.append, delta, delta_freq, n_cpus)) {
+            std::cerr << "item id does not fit 32 bits in " << opts.append << "\n";
+            return 1;
+        }
+        append_transactions(trxns, item_ids, rank_freq, delta, delta_freq);
+        n_trxns += delta.size();
+    }
+    if (!streaming && !from_snapshot)
+        n_trxns = trxns.size();
+    min_sup = ceil(fmin_sup * n_trxns);  // transform min support percent to min support count
+    METRICS_PHASE(input);
+
+    // remap item ids to dense ranks, snapshots are already remapped
+    METRICS_START(remap);
+    if (!from_snapshot) {
+        remap_transactions(trxns, item_freq, item_ids, rank_freq);
+    } else if (!snapshot.hdr->ranked && !appending) {
+        // a snapshot written after appending keeps the old order, rank again
+        std::vector<Item> old_ranks;
+        IdMap<int> old_freq;
+        old_freq.dense = rank_freq;
+        remap_transactions(trxns, old_freq, old_ranks, rank_freq);
+        for (Item& rank : old_ranks)
+            rank = item_ids[rank];
+        item_ids.swap(old_ranks);
+    }
+    // when appending, ranks keep their order and every rank is in the tree
+    int n_items = appending ? rank_freq.size() : std::partition_point(rank_freq.begin(), rank_freq.end(), [&](int freq) { return freq >= min_sup; }) - rank_freq.begin();
+    METRICS_PHASE(remap);
+
+    if (opts.engine == ENGINE_AUTO && opts.output != OUTPUT_PATTERNS) {
+        // only the tree engine prunes non closed patterns while mining, and counts or picks top K of single paths without enumerating them
+        opts.engine = ENGINE_TREE;
+    } else if (opts.engine == ENGINE_AUTO && ((from_snapshot && snapshot.tree(min_sup) != NULL) || !opts.snapshot.empty())) {
+        // the tree of a snapshot is mined without building anything, a saved snapshot carries a tree for later runs
+        opts.engine = ENGINE_TREE;
+    } else if (opts.engine == ENGINE_AUTO) {
+        // fraction of set bits in tidsets of frequent items
+        double n_occurs = std::accumulate(rank_freq.begin(), rank_freq.begin() + n_items, 0.0);
+        double density = n_items > 0 ? n_occurs / n_items / n_trxns : 0;
+        if (density >= MINBITSETDENSITY && BitsetDB::bytes(n_items, n_trxns) <= MAXBITSETBYTES)
+            opts.engine = ENGINE_BITSET;
+        else
+            opts.engine = ENGINE_PROJ;
+        DEBUG_MSG("Density: " << density << ", engine " << (opts.engine == ENGINE_BITSET ? "bitset" : "proj"));
+    }
+
+    // a usable tree of the snapshot replaces its transactions, unless they are saved again
+    const uint32_t* tree_block = from_snapshot && !appending && opts.engine == ENGINE_TREE ? snapshot.tree(min_sup) : NULL;
+    // a saved tree holds every rank, so that it can be appended to and mined at any support
+    if (!opts.snapshot.empty() && tree_block != NULL && snapshot.hdr->floor > 1)
+        tree_block = NULL;
+    if (from_snapshot && !appending && trxns.size() < n_trxns && (tree_block == NULL || !opts.snapshot.empty()))
+        snapshot.loadTrxns(trxns);
+
+    // only the tree engine saves its tree, it is built anyway
+    if (!opts.snapshot.empty() && opts.engine != ENGINE_TREE && !save_snapshot(opts.snapshot, trxns, item_ids, rank_freq, NULL, 0, false)) {
+        std::cerr << "cannot write snapshot " << opts.snapshot << "\n";
+        return 1;
+    }
+
+    // tasks write to the buffer of the thread running them
+    // in a sweep each writer passes patterns on to the writer of the next higher support
+    std::vector<std::unique_ptr<PatternWriter>> writers;
+    for (auto& [fsup, filename] : sweep) {
+        writers.emplace_back(new PatternWriter(filename, item_ids, ceil(fsup * n_trxns), n_trxns, n_cpus));
+        if (!writers.back()->is_open()) {
+            std::cerr << "Err: cannot open output " << filename << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        writers.back()->mode = opts.output;
+        writers.back()->top_k = opts.top_k;
+        writers.back()->deterministic = opts.deterministic;
+        writers.back()->binary = opts.binary;
+        writers.back()->compressed = opts.compressed;
+        writers.back()->writeHeader();
+        if (writers.size() > 1)
+            writers[writers.size() - 2]->higher = writers.back().get();
+    }
+    PatternWriter& writer = *writers[0];
+
+    if (streaming) {
+        // second pass, only the tree or partitions of it are kept
+        METRICS_START(stream_and_output);
+        if (!stream_fpgrowth(input_filename, item_ids, rank_freq, n_items, min_sup, (size_t)opts.stream << 20, writer, n_cpus)) {
+            std::cerr << "cannot stream " << input_filename << "\n";
+            return 1;
+        }
+        writer.close();
+        METRICS_PHASE(stream_and_output);
+    } else if (opts.engine == ENGINE_BITSET) {
+        // second scan, set bits of transactions
+        METRICS_START(build_bitsetdb);
+        BitsetDB db(n_items, trxns.size());
+        db.buildFromTrxns(trxns, rank_freq, n_cpus);
+        METRICS_PHASE(build_bitsetdb);
+
+        METRICS_START(eclat_and_output);
+        db.eclat(writer, min_sup, n_cpus);
+        writer.close();
+        METRICS_PHASE(eclat_and_output);
+    } else if (opts.engine == ENGINE_PROJ) {
+        // second scan, copy pruned transactions as rows
+        METRICS_START(build_projdb);
+        ProjDB db(n_items);
+        db.buildFromTrxns(trxns);
+        METRICS_PHASE(build_projdb);
+
+        METRICS_START(projgrowth_and_output);
+        db.projgrowth(writer, min_sup, n_cpus);
+        writer.close();
+        METRICS_PHASE(projgrowth_and_output);
+    } else {
+        // construct fptree
+        // set min_sup, build fptree
+        // second scan, build fptree and update table
+        METRICS_START(build_fptree);
+        FPTree fptree(n_items, item_ids);
+        std::unique_ptr<FPTree> full;  // tree of every rank to be saved, mined through its frozen block
+        if (appending) {
+            // only appended transactions are inserted into a tree of every rank, they are the last ones of trxns
+            const uint32_t* full_block = snapshot.fullTree();
+            if (full_block != NULL) {
+                fptree.buildFromFrozen(full_block, snapshot.hdr->n_nodes, snapshot.hdr->n_heads, snapshot.hdr->single_path, rank_freq, min_sup);
+                fptree.appendTrxns(trxns, trxns.size() - (n_trxns - snapshot.hdr->n_trxns));
+            } else {
+                std::cerr << "snapshot " << input_filename << " has no tree of every rank, rebuilding it from all transactions\n";
+                fptree.buildFromTrxns(trxns, rank_freq, min_sup);
+            }
+            fptree.freeze();
+        } else if (tree_block != NULL) {
+            // tree of the snapshot covers every rank frequent at this support
+            fptree.buildFromFrozen(tree_block, snapshot.hdr->n_nodes, snapshot.hdr->n_heads, snapshot.hdr->single_path, rank_freq, min_sup);
+        } else if (!opts.snapshot.empty()) {
+            // every rank is inserted as at support count 1, ranks below min_sup are pruned only while mining
+            full.reset(new FPTree(rank_freq.size(), item_ids));
+            full->buildFromTrxns(trxns, rank_freq, min_sup);
+            full->freeze();
+            fptree.buildFromFrozen(full->frozen.data(), full->frozen.n_nodes, full->frozen.n_heads, full->singlePath, rank_freq, min_sup);
+        } else {
+            fptree.buildFromTrxns(trxns, rank_freq, min_sup);
+            fptree.freeze();
+        }
+        METRICS_PHASE(build_fptree);
+
+        if (!opts.snapshot.empty() && !save_snapshot(opts.snapshot, trxns, item_ids, rank_freq, &fptree.frozen, 1, fptree.singlePath)) {
+            std::cerr << "cannot write snapshot " << opts.snapshot << "\n";
+            return 1;
+        }
+
+        // output once a pattern is found
+        METRICS_START(fpgrowth_and_output);
+        fptree.fpgrowth(writer, min_sup, n_cpus);
+        writer.close();
+        METRICS_PHASE(fpgrowth_and_output);
+    }
+    METRICS_PHASE(total);
+#ifdef METRICS
+    if (!opts.metrics.empty() && !metrics.dump(opts.metrics)) {
+        std::cerr << "cannot write metrics " << opts.metrics << "\n";
+        return 1;
+    }
+#endif  // METRICS
 
     return 0;
 }
 
-void FPTree::insertPath(const Transaction& trxn, std::unordered_map<Item, FPNode*>& tail_table, const int& inc) {
+bool parse_sweep(const std::string& supports, const std::string& filenames, std::vector<std::pair<double, std::string>>& sweep) {
+    size_t sup_pos = 0, file_pos = 0;
+    while (sup_pos <= supports.size() && file_pos <= filenames.size()) {
+        size_t sup_end = std::min(supports.find(',', sup_pos), supports.size());
+        size_t file_end = std::min(filenames.find(',', file_pos), filenames.size());
+        if (sup_end == sup_pos || file_end == file_pos)
+            return false;
+        sweep.emplace_back(atof(supports.substr(sup_pos, sup_end - sup_pos).c_str()), filenames.substr(file_pos, file_end - file_pos));
+        sup_pos = sup_end + 1;
+        file_pos = file_end + 1;
+    }
+    // both lists end together
+    if (sup_pos <= supports.size() || file_pos <= filenames.size())
+        return false;
+    std::stable_sort(sweep.begin(), sweep.end(), [](const std::pair<double, std::string>& x, const std::pair<double, std::string>& y) {
+        return x.first < y.first;
+    });
+    return true;
+}
+
+bool parse_options(int argc, char** argv, int first, Options& opts) {
+    for (int i = first; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--engine=tree")
+            opts.engine = ENGINE_TREE;
+        else if (arg == "--engine=proj")
+            opts.engine = ENGINE_PROJ;
+        else if (arg == "--engine=bitset")
+            opts.engine = ENGINE_BITSET;
+        else if (arg == "--engine=auto")
+            opts.engine = ENGINE_AUTO;
+        else if (arg == "--count")
+            opts.output = OUTPUT_COUNT;
+        else if (arg.compare(0, 16, "--save-snapshot=") == 0 && arg.size() > 16)
+            opts.snapshot = arg.substr(16);
+        else if (arg.compare(0, 9, "--append=") == 0 && arg.size() > 9)
+            opts.append = arg.substr(9);
+        else if (arg.compare(0, 10, "--metrics=") == 0 && arg.size() > 10)
+            opts.metrics = arg.substr(10);
+        else if (arg == "--stream")
+            opts.stream = STREAMBUDGET;
+        else if (arg.compare(0, 9, "--stream=") == 0) {
+            char* end;
+            long budget = strtol(arg.c_str() + 9, &end, 10);
+            if (*end != '\0' || end == arg.c_str() + 9 || budget < 0 || budget > INT_MAX)
+                return false;
+            opts.stream = budget;
+        }
+        else if (arg == "--deterministic")
+            opts.deterministic = true;
+        else if (arg == "--binary")
+            opts.binary = true;
+        else if (arg == "--binary=zlib")
+            opts.binary = opts.compressed = true;
+        else if (arg == "--closed")
+            opts.output = OUTPUT_CLOSED;
+        else if (arg == "--maximal")
+            opts.output = OUTPUT_MAXIMAL;
+        else if (arg.compare(0, 6, "--top=") == 0) {
+            char* end;
+            long top_k = strtol(arg.c_str() + 6, &end, 10);
+            if (*end != '\0' || top_k <= 0 || top_k > INT_MAX)
+                return false;
+            opts.output = OUTPUT_TOPK;
+            opts.top_k = top_k;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+void FPTree::insertPath(const Item* path, const Item* path_end, std::vector<FPNode*>& tail_table, const int& inc) {
     FPNode* curr = root;
-    for (int j = (int)trxn.size() - 1; j >= 0; j--) {
-        Item item = trxn[j];
-        auto it = curr->child.find(item);
+    for (; path != path_end; path++) {
+        Item item = *path;
+        FPNode* next = curr->child.find(item);
         // if exist move curr, else create and move
-        if (it != curr->child.end()) {
-            curr = it->second;
+        if (next != NULL) {
+            curr = next;
         } else {
-            if (curr->child.size() >= 1)
+            if (!curr->child.empty())
                 singlePath = false;
-            FPNode* node = new FPNode(item);
+            FPNode* node = arena.make<FPNode>(item, arena);
             node->parent = curr;
-            curr = curr->child[item] = node;
-            if (tail_table.find(item) == tail_table.end()) {
+            curr->child.add(node);
+            curr = node;
+            if (tail_table[item] == NULL) {
                 hdr_table[item] = tail_table[item] = node;
             } else {
                 tail_table[item] = tail_table[item]->next = node;
@@ -210,185 +1220,326 @@ void FPTree::insertPath(const Transaction& trxn, std::unordered_map<Item, FPNode
     }
 }
 
-void FPTree::buildFromTrxns(const std::vector<Transaction>& trxns, const int& min_sup) {
-    for (auto& pair : item_freq) {
-        if (pair.second >= min_sup) {
-            items_by_freq.emplace_back(pair.first);
-        }
+void FPTree::countRanks(const std::vector<int>& rank_freq, const int& min_sup) {
+    // ranks are decreasing by frequency unless they keep the order of an appended tree
+    for (Item item = 0; item < (int)item_freq.size(); item++) {
+        item_freq[item] = rank_freq[item];
+        if (item_freq[item] >= min_sup)
+            items_by_freq.emplace_back(item);
     }
     std::sort(items_by_freq.begin(), items_by_freq.end(), REFDEC(item_freq));
+}
 
-    std::unordered_map<Item, FPNode*> tail_table;
-    for (int i = 0; i < (int)trxns.size(); i++) {
-        Transaction trxn;
-        // prune infrequent items
-        for (int j = 0; j < (int)trxns[i].size(); j++) {
-            Item item = trxns[i][j];
-            if (item_freq[item] >= min_sup)
-                trxn.emplace_back(item);
-        }
-        // sort transaction by freq
-        std::sort(trxn.begin(), trxn.end(), REFINC(item_freq));
+void FPTree::buildFromTrxns(const Transactions& trxns, const std::vector<int>& rank_freq, const int& min_sup) {
+    countRanks(rank_freq, min_sup);
+
+    std::vector<FPNode*> tail_table(item_freq.size(), NULL);
+    for (size_t i = 0; i < trxns.size(); i++) {
+        // prune infrequent items, which are at the end of sorted transaction
+        const Item* begin = trxns.begin(i);
+        const Item* end = std::lower_bound(begin, trxns.end(i), (Item)item_freq.size());
 
         // add path to fptree
-        insertPath(trxn, tail_table, 1);
+        insertPath(begin, end, tail_table, 1);
+    }
+}
+
+void FPTree::freeze() {
+    size_t n_nodes = arena.n_nodes;
+    size_t n_heads = hdr_table.size();
+    frozen.storage.assign(4 * n_nodes + n_heads, 0);
+    Item* items = (Item*)frozen.storage.data();
+    int* cnts = (int*)frozen.storage.data() + n_nodes;
+    FrozenTree::Node* parents = frozen.storage.data() + 2 * n_nodes;
+    FrozenTree::Node* nexts = frozen.storage.data() + 3 * n_nodes;
+    FrozenTree::Node* heads = frozen.storage.data() + 4 * n_nodes;
+
+    // number nodes in DFS preorder
+    FrozenTree::Node idx = 0;
+    std::vector<std::pair<const FPNode*, FrozenTree::Node>> stack{{root, 0}};
+    while (!stack.empty()) {
+        auto [node, parent] = stack.back();
+        stack.pop_back();
+        items[idx] = node->item;
+        cnts[idx] = node->cnt;
+        parents[idx] = parent;
+        node->child.forEach([&](const FPNode* child) { stack.emplace_back(child, idx); });
+        idx++;
+    }
+    assert(idx == n_nodes);
+
+    // header chains follow node order
+    std::vector<FrozenTree::Node> tail_table(n_heads, 0);
+    for (FrozenTree::Node node = 1; node < n_nodes; node++) {
+        Item item = items[node];
+        if (tail_table[item] == 0)
+            heads[item] = node;
+        else
+            nexts[tail_table[item]] = node;
+        tail_table[item] = node;
+    }
+    frozen.attach(frozen.storage.data(), n_nodes, n_heads);
+
+    // release pointer nodes
+    arena.reset();
+    root = arena.make<FPNode>(-1, arena);
+    std::fill(hdr_table.begin(), hdr_table.end(), (FPNode*)NULL);
+}
+
+void FPTree::buildFromFrozen(const uint32_t* block, size_t n_nodes, size_t n_heads, bool single_path, const std::vector<int>& rank_freq, const int& min_sup) {
+    // the tree may hold more ranks than this one
+    countRanks(rank_freq, min_sup);
+    frozen.attach(block, n_nodes, n_heads);
+    singlePath = single_path;
+}
+
+void FPTree::appendTrxns(const Transactions& trxns, size_t first) {
+    // nodes are in DFS order, so parents are created first, header chains keep node order
+    std::vector<FPNode*> nodes(frozen.size(), root);
+    std::vector<FPNode*> tail_table(hdr_table.size(), NULL);
+    for (FrozenTree::Node idx = 1; idx < frozen.size(); idx++) {
+        FPNode* node = arena.make<FPNode>(frozen.items[idx], arena);
+        node->cnt = frozen.cnts[idx];
+        node->parent = nodes[frozen.parents[idx]];
+        node->parent->child.add(node);
+        nodes[idx] = node;
+        Item item = node->item;
+        if (tail_table[item] == NULL)
+            hdr_table[item] = tail_table[item] = node;
+        else
+            tail_table[item] = tail_table[item]->next = node;
     }
+    frozen = FrozenTree();
+
+    for (size_t i = first; i < trxns.size(); i++)
+        insertPath(trxns.begin(i), trxns.end(i), tail_table, 1);
 }
 
-void FPTree::fpgrowthCombinationThread(int idx, std::vector<Item>& lst, std::string&& base_str, std::ofstream& output_file, size_t trxns_size, std::ostringstream& oss) {
-    if (idx == (int)items_by_freq.size())
+void FPTree::fpgrowthCombinationThread(int idx, std::string& prefix, const SinglePath& path, PatternWriter& writer, OutStream& out) {
+    if (idx == (int)path.size())
         return;
 
     // Choose
-    Item currItem = items_by_freq[idx];
-    lst.emplace_back(currItem);
+    size_t prefix_len = prefix.size();
+    prefix.append(path.strs, path.str_offsets[idx], path.str_offsets[idx + 1] - path.str_offsets[idx]);
 
     // output current combination
-    oss << *lst.begin();
-    std::for_each(lst.begin() + 1, lst.end(), [&](const auto& item) {
-        oss << ',' << item;
-    });
-    oss << std::move(base_str);
-    oss << std::fixed << std::setprecision(4) << ':' << (double)item_freq[currItem] / trxns_size << '\n';
-    if (oss.tellp() >= MAXOSSBUF) {
-        std::string str = oss.str();
-#pragma omp critical
-        output_file.write(str.data(), str.size());
-        reset_oss(oss);
-    }
+    writer.writeLine(out, prefix.data(), prefix.size(), path.suffix, path.cnts[idx], path.sup_strs[idx]);
 
-    fpgrowthCombinationThread(idx + 1, lst, std::move(base_str), output_file, trxns_size, oss);
-    lst.pop_back();
+    fpgrowthCombinationThread(idx + 1, prefix, path, writer, out);
+    prefix.resize(prefix_len);
 
     // Not choose
-    fpgrowthCombinationThread(idx + 1, lst, std::move(base_str), output_file, trxns_size, oss);
+    fpgrowthCombinationThread(idx + 1, prefix, path, writer, out);
 }
 
-void FPTree::fpgrowthCombination(std::string&& base_str, std::ofstream& output_file, const size_t& trxns_size, std::array<std::ostringstream, NCPUS>& oss_arr, const int& n_cpus) {
-    std::deque<std::pair<int, std::vector<Item>>> que;
-    que.emplace_back(0, std::vector<Item>());
-    while ((int)que.size() < n_cpus) {
+void FPTree::fpgrowthCombination(const Transaction& base, PatternWriter& writer, const int& n_cpus) {
+    if (writer.closedOnly()) {
+        // a prefix of the path is closed if the next position has smaller support, only the whole path is maximal
+        Transaction comb(base);
+        for (size_t i = 0; i < items_by_freq.size(); i++) {
+            comb.emplace_back(items_by_freq[i]);
+            bool last = i + 1 == items_by_freq.size();
+            if (last || (writer.mode == OUTPUT_CLOSED && item_freq[items_by_freq[i]] > item_freq[items_by_freq[i + 1]]))
+                writer.write(writer.local(), comb.data(), comb.size(), std::string(), item_freq[items_by_freq[i]]);
+        }
+        return;
+    }
+    std::string base_str;
+    writer.format(base_str, base.data(), base.size());
+    if (writer.mode == OUTPUT_COUNT) {
+        // every non empty combination of the k items meeting support of each writer, 2^k - 1
+        for (PatternWriter* curr = &writer; curr != NULL; curr = curr->higher) {
+            size_t k = std::partition_point(items_by_freq.begin(), items_by_freq.end(), [&](Item item) { return item_freq[item] >= curr->min_sup; }) - items_by_freq.begin();
+            uint64_t n_combs = k >= 64 ? UINT64_MAX : ((uint64_t)1 << k) - 1;
+            curr->count(curr->local(), n_combs);
+            if (curr == &writer)
+                METRICS_ADD(metrics.local().n_patterns, n_combs);
+        }
+        return;
+    } else if (writer.mode == OUTPUT_TOPK) {
+        // combinations ending at position i share support of i, at most top_k of them can be kept
+        Transaction comb;
+        for (size_t i = 0; i < items_by_freq.size() && !writer.pruned(item_freq[items_by_freq[i]]); i++) {
+            uint64_t n_combs = std::min(i >= 63 ? UINT64_MAX : (uint64_t)1 << i, (uint64_t)writer.top_k);
+            for (uint64_t mask = 0; mask < n_combs; mask++) {
+                comb.clear();
+                for (size_t b = 0; b < i; b++) {
+                    if (mask >> b & 1)
+                        comb.emplace_back(items_by_freq[b]);
+                }
+                comb.emplace_back(items_by_freq[i]);
+                writer.write(writer.local(), comb.data(), comb.size(), base_str, item_freq[items_by_freq[i]]);
+            }
+        }
+        return;
+    }
+
+    // precompute strings of each position, enumeration only reads these arrays
+    SinglePath path;
+    path.suffix = base_str;
+    path.str_offsets.emplace_back(0);
+    for (Item item : items_by_freq) {
+        writer.format(path.strs, &item, 1);
+        path.str_offsets.emplace_back(path.strs.size());
+        path.cnts.emplace_back(item_freq[item]);
+        path.sup_strs.emplace_back(writer.supportString(item_freq[item]));
+    }
+
+    OutStream& out = writer.local();
+    std::deque<std::pair<int, std::string>> que;
+    que.emplace_back(0, std::string());
+    // short paths are not worth splitting into tasks, a fixed split keeps the order in deterministic mode
+    int n_tasks = (int)path.size() < MINTASKPATH ? 1 : writer.deterministic ? DETERMINISTICTASKS : n_cpus;
+    while ((int)que.size() < n_tasks) {
         auto pair = que.front();
-        if (pair.first == (int)items_by_freq.size())
+        if (pair.first == (int)path.size())
             break;
         que.pop_front();
-        Item currItem = items_by_freq[pair.first];
+        int idx = pair.first;
+        size_t prefix_len = pair.second.size();
         pair.first++;
         // choose
-        pair.second.emplace_back(currItem);
+        pair.second.append(path.strs, path.str_offsets[idx], path.str_offsets[idx + 1] - path.str_offsets[idx]);
         que.emplace_back(pair);
         // output current combination
-        int ioss = currItem % NCPUS;
-        oss_arr[ioss] << *pair.second.begin();
-        std::for_each(pair.second.begin() + 1, pair.second.end(), [&](const auto& item) {
-            oss_arr[ioss] << ',' << item;
-        });
-        oss_arr[ioss] << std::move(base_str);
-        oss_arr[ioss] << std::fixed << std::setprecision(4) << ':' << (double)item_freq[currItem] / trxns_size << '\n';
-        if (oss_arr[ioss].tellp() >= MAXOSSBUF) {
-            std::string str = oss_arr[ioss].str();
-            output_file.write(str.data(), str.size());
-            reset_oss(oss_arr[ioss]);
-        }
+        writer.writeLine(out, pair.second.data(), pair.second.size(), path.suffix, path.cnts[idx], path.sup_strs[idx]);
 
         // remove
-        pair.second.pop_back();
+        pair.second.resize(prefix_len);
         // not choose
         que.emplace_back(pair);
     }
 
-#pragma omp parallel for
+    if (que.size() == 1) {
+        que[0].second.reserve(path.strs.size());
+        fpgrowthCombinationThread(que[0].first, que[0].second, path, writer, out);
+        return;
+    }
+    // a team of one thread runs tasks in program order without deferring them
+    // segments are forked all the same, so binary records and blocks end at the same places
+    bool defer = omp_get_num_threads() > 1;
     for (int i = 0; i < (int)que.size(); i++) {
-        que[i].second.reserve(items_by_freq.size());
-        fpgrowthCombinationThread(que[i].first, que[i].second, std::move(base_str), output_file, trxns_size, oss_arr[i]);
+        Segment* seg = writer.fork(out);
+#pragma omp task firstprivate(i, seg) shared(que, path, writer) if (defer)
+        {
+            SegmentScope scope(writer, seg);
+            que[i].second.reserve(path.strs.size());
+            fpgrowthCombinationThread(que[i].first, que[i].second, path, writer, writer.local());
+        }
     }
+#pragma omp taskwait
 }
 
-void FPTree::growth(FPNode* preroot, FPNode* prehead, const int& min_sup) {
+template <typename Tree>
+void FPTree::growth(const Tree& tree, const Item& base_item, const int& min_sup, const bool& merge) {
     // count frequency of current tree
-    for (FPNode* leaf = prehead; leaf != NULL; leaf = leaf->next) {
-        for (FPNode* curr = leaf->parent; curr != preroot; curr = curr->parent) {
-            item_freq[curr->item] += leaf->cnt;
+    int base_sup = 0;
+    for (auto leaf = tree.first(base_item); tree.valid(leaf); leaf = tree.next(leaf)) {
+        base_sup += tree.cnt(leaf);
+        for (auto curr = tree.parent(leaf); tree.valid(curr); curr = tree.parent(curr)) {
+            item_freq[tree.item(curr)] += tree.cnt(leaf);
         }
     }
-    for (auto& pair : item_freq) {
-        if (pair.second >= min_sup) {
-            items_by_freq.emplace_back(pair.first);
+    for (Item item = 0; item < (int)item_freq.size(); item++) {
+        if (merge && item_freq[item] == base_sup) {
+            // merged items leave the tree, a frequency of 0 drops them from the paths
+            merged.emplace_back(item);
+            item_freq[item] = 0;
+        } else if (item_freq[item] >= min_sup) {
+            items_by_freq.emplace_back(item);
         }
     }
     std::sort(items_by_freq.begin(), items_by_freq.end(), REFDEC(item_freq));
 
     // construct conditional tree
-    std::unordered_map<Item, FPNode*> tail_table;
-    for (FPNode* leaf = prehead; leaf != NULL; leaf = leaf->next) {
-        // get path
-        Transaction trxn;
-        for (FPNode* curr = leaf->parent; curr != preroot; curr = curr->parent) {
-            if (item_freq[curr->item] >= min_sup)
-                trxn.emplace_back(curr->item);
+    std::vector<FPNode*> tail_table(item_freq.size(), NULL);
+    Transaction trxn;
+    for (auto leaf = tree.first(base_item); tree.valid(leaf); leaf = tree.next(leaf)) {
+        // get path, collected from leaf side
+        trxn.clear();
+        for (auto curr = tree.parent(leaf); tree.valid(curr); curr = tree.parent(curr)) {
+            if (item_freq[tree.item(curr)] >= min_sup)
+                trxn.emplace_back(tree.item(curr));
         }
+        std::reverse(trxn.begin(), trxn.end());
 
         // add path to conditional tree
-        insertPath(trxn, tail_table, leaf->cnt);
+        insertPath(trxn.data(), trxn.data() + trxn.size(), tail_table, tree.cnt(leaf));
     }
 }
 
-void FPTree::fpgrowth(const std::string& output_filename, const int& min_sup, const size_t& trxns_size, const int& n_cpus) {
-    std::ofstream output_file(output_filename);
-    if (output_file.is_open()) {
+void FPTree::fpgrowth(PatternWriter& writer, const int& min_sup, const int& n_cpus) {
+    arena_stats.n_bytes = arena_stats.n_nodes = 0;
+#pragma omp parallel num_threads(n_cpus)
+#pragma omp single
+    {
+        // the whole run is one segment, so output outside of tasks keeps its order across runs of a stream
+        SegmentScope scope(writer, writer.fork(writer.local()));
         Transaction base;
-        std::array<std::ostringstream, NCPUS> oss_arr;
-        std::ostringstream base_oss;
-        fpgrowth(base, min_sup, output_file, trxns_size, oss_arr, base_oss, n_cpus);
-        for (auto& oss : oss_arr) {
-            std::string str = oss.str();
-            output_file.write(str.data(), str.size());
-        }
-        output_file.close();
+        fpgrowth(base, min_sup, writer, n_cpus);
     }
+    DEBUG_MSG("Arena: " << arena.n_nodes + arena_stats.n_nodes << " nodes, "
+                        << arena.n_bytes + arena_stats.n_bytes << " bytes, "
+                        << arena_stats.n_chunks << " chunks malloced");
 }
 
-void FPTree::fpgrowth(Transaction& base, const int& min_sup,
-                      std::ofstream& output_file, const size_t& trxns_size,
-                      std::array<std::ostringstream, NCPUS>& oss_arr, std::ostringstream& base_oss, const int& n_cpus) {
+void FPTree::fpgrowth(const Transaction& base, const int& min_sup, PatternWriter& writer, const int& n_cpus) {
     if (hasSinglePath()) {
-        reset_oss(base_oss);
-        std::for_each(base.begin(), base.end(), [&](const auto& item) {
-            base_oss << ',' << item;
-        });
-        fpgrowthCombination(std::move(base_oss.str()), output_file, trxns_size, oss_arr, n_cpus);
+        METRICS_ADD(metrics.local().depth(base.size()).n_single_paths, 1);
+        fpgrowthCombination(base, writer, n_cpus);
     } else {
         for (int i = (int)items_by_freq.size() - 1; i >= 0; i--) {
-            Item baseItem = items_by_freq[i];
-            base.emplace_back(baseItem);
+            // each suffix item is an independent task, deep trees are too small to be worth deferring
+            bool task = (int)base.size() < MAXTASKDEPTH;
+            Segment* seg = task ? writer.fork(writer.local()) : NULL;
+#pragma omp task firstprivate(i, seg) shared(base, writer) if (task && omp_get_num_threads() > 1)
+            {
+                SegmentScope scope(writer, seg);
+                Item baseItem = items_by_freq[i];
+                Transaction cond_base(base);
+                cond_base.emplace_back(baseItem);
 
-            // output base
-            int ioss = i % NCPUS;
-            oss_arr[ioss] << *base.begin();
-            std::for_each(base.begin() + 1, base.end(), [&](const auto& item) {
-                oss_arr[ioss] << ',' << item;
-            });
-            oss_arr[ioss] << std::fixed << std::setprecision(4) << ':' << (double)item_freq[baseItem] / trxns_size << '\n';
-            if (oss_arr[ioss].tellp() >= MAXOSSBUF) {
-                std::string str = oss_arr[ioss].str();
-                output_file.write(str.data(), str.size());
-                reset_oss(oss_arr[ioss]);
-            }
+                // build conditional fptree, prefix paths only contain items of smaller rank
+                // extensions have at most the support of base
+                FPTree cond_fptree(baseItem, item_ids);
+                if (!writer.pruned(item_freq[baseItem])) {
+                    METRICS_START(growth);
+                    if (frozen.size() == 0)
+                        cond_fptree.growth(*this, baseItem, min_sup, writer.closedOnly());
+                    else
+                        cond_fptree.growth(frozen, baseItem, min_sup, writer.closedOnly());
+                    METRICS_ACCUM(growth, metrics.local().depth(base.size() + 1).growth_ticks);
+                    METRICS_ADD(metrics.local().depth(base.size() + 1).n_trees, 1);
+                    METRICS_ADD(metrics.local().depth(base.size() + 1).n_nodes, cond_fptree.arena.n_nodes);
+                }
+                cond_base.insert(cond_base.end(), cond_fptree.merged.begin(), cond_fptree.merged.end());
 
-            // build conditional fptree
-            FPTree cond_fptree;
-            cond_fptree.growth(root, hdr_table[baseItem], min_sup);
+                // output base, only bases without extensions can be maximal
+                if (writer.mode != OUTPUT_MAXIMAL || cond_fptree.empty()) {
+                    METRICS_ADD(metrics.local().depth(base.size() + 1).n_bases, 1);
+                    writer.write(writer.local(), cond_base.data(), cond_base.size(), std::string(), item_freq[baseItem]);
+                }
 
-            if (!cond_fptree.empty()) {
-                cond_fptree.fpgrowth(base, min_sup, output_file, trxns_size, oss_arr, base_oss, n_cpus);
+                if (!cond_fptree.empty()) {
+                    cond_fptree.fpgrowth(cond_base, min_sup, writer, n_cpus);
+                }
             }
-            base.pop_back();
         }
+        // children tasks reference this tree
+#pragma omp taskwait
     }
 }
 
+void FPTree::keepSuffixes(const Item& lo) {
+    items_by_freq.erase(std::remove_if(items_by_freq.begin(), items_by_freq.end(), [&](Item item) { return item < lo; }), items_by_freq.end());
+    // combinations of a single path would also take lower ranks
+    if (lo > 0)
+        singlePath = false;
+}
+
 bool FPTree::empty() {
-    return root->child.size() == 0;
+    return root->child.empty() && frozen.size() <= 1;
 }
 
 bool FPTree::hasSinglePath() {
@@ -398,42 +1549,1283 @@ bool FPTree::hasSinglePath() {
 void FPTree::traverse(FPNode* node) {
     if (node == NULL)
         return;
-    for (auto child : node->child) {
-        std::cout << child.second->item << " " << child.second->cnt << "\n";
-        traverse(child.second);
+    node->child.forEach([&](FPNode* child) {
+        std::cout << (uint32_t)item_ids[child->item] << " " << child->cnt << "\n";
+        traverse(child);
+    });
+}
+
+void* Arena::allocate(size_t size, size_t align) {
+    char* ptr = (char*)(((uintptr_t)curr + align - 1) & ~(uintptr_t)(align - 1));
+    if (head == NULL || ptr + size > end) {
+        assert(sizeof(char*) + size + align <= ARENACHUNK);
+        char* chunk = chunk_pool.head;
+        if (chunk != NULL) {
+            chunk_pool.head = *(char**)chunk;
+        } else {
+            chunk = (char*)malloc(ARENACHUNK);
+            arena_stats.n_chunks++;
+        }
+        *(char**)chunk = head;
+        head = chunk;
+        curr = chunk + sizeof(char*);
+        end = chunk + ARENACHUNK;
+        ptr = (char*)(((uintptr_t)curr + align - 1) & ~(uintptr_t)(align - 1));
     }
+    curr = ptr + size;
+    n_bytes += size;
+    return ptr;
 }
 
-void FPTree::deleteTree(FPNode* node) {
-    if (node == NULL)
+void Arena::reset() {
+    while (head != NULL) {
+        char* prev = *(char**)head;
+        *(char**)head = chunk_pool.head;
+        chunk_pool.head = head;
+        head = prev;
+    }
+    curr = end = NULL;
+}
+
+void ProjDB::buildFromTrxns(const Transactions& trxns) {
+    items.reserve(trxns.items.size());
+    for (size_t i = 0; i < trxns.size(); i++) {
+        const Item* end = std::lower_bound(trxns.begin(i), trxns.end(i), (Item)item_freq.size());
+        if (end == trxns.begin(i))
+            continue;
+        for (const Item* item = trxns.begin(i); item != end; item++)
+            item_freq[*item]++;
+        items.insert(items.end(), trxns.begin(i), end);
+        offsets.emplace_back(items.size());
+        cnts.emplace_back(1);
+    }
+}
+
+void ProjDB::project(const ProjDB& parent, const Item& item, const int& min_sup) {
+    for (size_t k = parent.occ_offsets[item]; k < parent.occ_offsets[item + 1]; k++) {
+        size_t row = parent.occ_rows[k];
+        int cnt = parent.cnts[row];
+        size_t row_begin = items.size();
+        // count frequency for the next level in the same scan
+        for (size_t j = parent.offsets[row]; j < parent.occ_pos[k]; j++) {
+            Item prefix_item = parent.items[j];
+            if (parent.item_freq[prefix_item] >= min_sup) {
+                items.emplace_back(prefix_item);
+                item_freq[prefix_item] += cnt;
+            }
+        }
+        if (items.size() > row_begin) {
+            offsets.emplace_back(items.size());
+            cnts.emplace_back(cnt);
+        }
+    }
+}
+
+void ProjDB::index(const int& min_sup) {
+    // counting sort of positions by item
+    occ_offsets.assign(item_freq.size() + 1, 0);
+    for (Item item : items) {
+        if (item_freq[item] >= min_sup)
+            occ_offsets[item + 1]++;
+    }
+    for (size_t i = 0; i < item_freq.size(); i++)
+        occ_offsets[i + 1] += occ_offsets[i];
+    occ_rows.resize(occ_offsets.back());
+    occ_pos.resize(occ_offsets.back());
+    std::vector<size_t> tails(occ_offsets.begin(), occ_offsets.end() - 1);
+    for (size_t row = 0; row < size(); row++) {
+        for (size_t j = offsets[row]; j < offsets[row + 1]; j++) {
+            Item item = items[j];
+            if (item_freq[item] >= min_sup) {
+                occ_rows[tails[item]] = row;
+                occ_pos[tails[item]++] = j;
+            }
+        }
+    }
+}
+
+void ProjDB::projgrowth(PatternWriter& writer, const int& min_sup, const int& n_cpus) {
+#pragma omp parallel num_threads(n_cpus)
+#pragma omp single
+    {
+        SegmentScope scope(writer, writer.fork(writer.local()));
+        Transaction base;
+        projgrowth(base, min_sup, writer);
+    }
+}
+
+void ProjDB::projgrowth(const Transaction& base, const int& min_sup, PatternWriter& writer) {
+    index(min_sup);
+    for (Item item = (int)item_freq.size() - 1; item >= 0; item--) {
+        if (item_freq[item] < min_sup)
+            continue;
+        // each item is an independent task, deep databases are too small to be worth deferring
+        bool task = (int)base.size() < MAXTASKDEPTH;
+        Segment* seg = task ? writer.fork(writer.local()) : NULL;
+#pragma omp task firstprivate(item, seg) shared(base, writer) if (task && omp_get_num_threads() > 1)
+        {
+            SegmentScope scope(writer, seg);
+            Transaction cond_base(base);
+            cond_base.emplace_back(item);
+
+            // output base
+            writer.write(writer.local(), cond_base.data(), cond_base.size(), std::string(), item_freq[item]);
+
+            // project rows containing item, prefix rows only contain items of smaller rank
+            // extensions have at most the support of base
+            if (!writer.pruned(item_freq[item])) {
+                ProjDB cond_db(item);
+                cond_db.project(*this, item, min_sup);
+                if (cond_db.size() > 0)
+                    cond_db.projgrowth(cond_base, min_sup, writer);
+            }
+        }
+    }
+    // children tasks reference this database
+#pragma omp taskwait
+}
+
+void BitsetDB::buildFromTrxns(const Transactions& trxns, const std::vector<int>& rank_freq, const int& n_cpus) {
+    std::copy(rank_freq.begin(), rank_freq.begin() + item_freq.size(), item_freq.begin());
+    // left uninitialized, each word is first touched by the thread setting it
+    sets.reset(new uint64_t[item_freq.size() * n_words]);
+    // each word holds 64 transactions, so threads never write the same word
+#pragma omp parallel for schedule(static) num_threads(n_cpus)
+    for (size_t word = 0; word < n_words; word++) {
+        for (size_t item = 0; item < item_freq.size(); item++)
+            sets[item * n_words + word] = 0;
+        size_t trxn_end = std::min(trxns.size(), (word + 1) * 64);
+        for (size_t i = word * 64; i < trxn_end; i++) {
+            uint64_t bit = (uint64_t)1 << (i % 64);
+            for (const Item* item = trxns.begin(i); item != trxns.end(i) && *item < (Item)item_freq.size(); item++)
+                sets[*item * n_words + word] |= bit;
+        }
+    }
+}
+
+void BitsetDB::eclat(PatternWriter& writer, const int& min_sup, const int& n_cpus) {
+    std::vector<Item> items(item_freq.size());
+    std::iota(items.begin(), items.end(), 0);
+#pragma omp parallel num_threads(n_cpus)
+#pragma omp single
+    {
+        SegmentScope scope(writer, writer.fork(writer.local()));
+        Transaction base;
+        eclat(base, items.data(), item_freq.data(), sets.get(), items.size(), min_sup, writer);
+    }
+}
+
+void BitsetDB::eclat(const Transaction& base, const Item* items, const int* sups, const uint64_t* class_sets, size_t n, const int& min_sup, PatternWriter& writer) {
+    for (int i = (int)n - 1; i >= 0; i--) {
+        // each item is an independent task, deep classes are too small to be worth deferring
+        bool task = (int)base.size() < MAXTASKDEPTH;
+        Segment* seg = task ? writer.fork(writer.local()) : NULL;
+#pragma omp task firstprivate(i, seg) shared(base, writer) if (task && omp_get_num_threads() > 1)
+        {
+            SegmentScope scope(writer, seg);
+            Transaction cond_base(base);
+            cond_base.emplace_back(items[i]);
+
+            // output base
+            writer.write(writer.local(), cond_base.data(), cond_base.size(), std::string(), sups[i]);
+
+            // intersect with members before i, frequent ones form the class of cond_base
+            // extensions have at most the support of base
+            std::vector<Item> cond_items;
+            std::vector<int> cond_sups;
+            std::unique_ptr<uint64_t[]> cond_sets(new uint64_t[i * n_words]);
+            const uint64_t* set = class_sets + i * n_words;
+            for (int j = 0; j < i && !writer.pruned(sups[i]); j++) {
+                uint64_t* cond_set = cond_sets.get() + cond_items.size() * n_words;
+                int sup = and_count_fn(class_sets + j * n_words, set, cond_set, n_words);
+                if (sup >= min_sup) {
+                    cond_items.emplace_back(items[j]);
+                    cond_sups.emplace_back(sup);
+                }
+            }
+            if (!cond_items.empty())
+                eclat(cond_base, cond_items.data(), cond_sups.data(), cond_sets.get(), cond_items.size(), min_sup, writer);
+        }
+    }
+    // children tasks reference this class
+#pragma omp taskwait
+}
+
+int and_count(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n_words) {
+    int cnt = 0;
+    for (size_t i = 0; i < n_words; i++) {
+        out[i] = a[i] & b[i];
+        cnt += __builtin_popcountll(out[i]);
+    }
+    return cnt;
+}
+
+__attribute__((target("avx2,popcnt"))) int and_count_avx2(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n_words) {
+    // count bits of each nibble by table lookup, then sum bytes of each 64 bit lane
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n_words; i += 4) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+        _mm256_storeu_si256((__m256i*)(out + i), v);
+        __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_mask));
+        __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+    int cnt = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) + _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+    for (; i < n_words; i++) {
+        out[i] = a[i] & b[i];
+        cnt += __builtin_popcountll(out[i]);
+    }
+    return cnt;
+}
+
+PatternWriter::PatternWriter(const std::string& output_filename, const std::vector<Item>& item_ids, const int& min_sup, const size_t& trxns_size, const int& n_threads)
+    : outs(n_threads), item_ids(item_ids), trxns_size(trxns_size), min_sup(min_sup), stop(-1), n_written(0), io_ticks(0) {
+    cursor.emplace_back(&root, 0);
+    fd = open(output_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+    size_t n_sups = trxns_size >= (size_t)min_sup ? trxns_size - min_sup + 1 : 0;
+    if (n_sups <= MAXSUPCACHE) {
+        sup_strs.resize(n_sups);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n_sups; i++)
+            sup_strs[i] = formatSupport(min_sup + i);
+    }
+    // each thread allocates and first touches its own buffers, so they are placed on its NUMA node
+#pragma omp parallel num_threads(n_threads)
+    {
+        int i = omp_get_thread_num();
+        outs[i].buf = acquire(outs[i], i);
+        outs[i].buf->reserve(MAXOSSBUF);
+        memset(outs[i].buf->data, 0, MAXOSSBUF);
+    }
+    // a smaller team leaves some streams unset
+    for (int i = 0; i < n_threads; i++) {
+        if (outs[i].buf == NULL)
+            outs[i].buf = acquire(outs[i], i);
+    }
+    io_thread = std::thread(&PatternWriter::ioLoop, this);
+}
+
+PatternWriter::~PatternWriter() {
+    close();
+}
+
+void PatternWriter::write(OutStream& out, const Item* items, size_t n_items, const std::string& suffix, const int& cnt) {
+    METRICS_START(format);
+    METRICS_ADD(metrics.local().n_patterns, 1);
+    writeOwn(out, items, n_items, suffix, cnt);
+    // summaries are kept per writer, formatted lines are copied by forward instead
+    size_t tid = &out - outs.data();
+    for (PatternWriter* writer = higher; writer != NULL && mode != OUTPUT_PATTERNS && cnt >= writer->min_sup; writer = writer->higher)
+        writer->writeOwn(writer->outs[tid], items, n_items, suffix, cnt);
+    METRICS_ACCUM(format, metrics.local().format_ticks);
+}
+
+void PatternWriter::writeOwn(OutStream& out, const Item* items, size_t n_items, const std::string& suffix, const int& cnt) {
+    if (mode == OUTPUT_COUNT) {
+        out.n_patterns++;
+        return;
+    }
+    if (mode == OUTPUT_TOPK) {
+        if (pruned(cnt))
+            return;
+        // ties are broken by line, the same order summarize sorts by
+        auto cmp = [](const std::pair<int, std::string>& x, const std::pair<int, std::string>& y) {
+            return x.first != y.first ? x.first > y.first : x.second < y.second;
+        };
+        std::string line;
+        format(line, items, n_items);
+        line += suffix;
+        out.top.emplace_back(cnt, std::move(line));
+        std::push_heap(out.top.begin(), out.top.end(), cmp);
+        if ((int)out.top.size() > top_k) {
+            std::pop_heap(out.top.begin(), out.top.end(), cmp);
+            out.top.pop_back();
+        }
+        if ((int)out.top.size() == top_k) {
+            int curr = top_min.load(std::memory_order_relaxed);
+            while (out.top.front().first > curr && !top_min.compare_exchange_weak(curr, out.top.front().first, std::memory_order_relaxed))
+                ;
+        }
+        return;
+    }
+    if (closedOnly()) {
+        assert(suffix.empty());
+        Transaction cand(items, items + n_items);
+        std::sort(cand.begin(), cand.end());
+        out.cands.emplace_back(cnt, std::move(cand));
+        return;
+    }
+    writePattern(out, items, n_items, suffix, cnt);
+}
+
+void PatternWriter::writePattern(OutStream& out, const Item* items, size_t n_items, const std::string& suffix, const int& cnt) {
+    if (binary) {
+        out.record.clear();
+        format(out.record, items, n_items);
+        out.record += suffix;
+        writeRecord(out, cnt);
+        return;
+    }
+    OutBuf* buf = out.buf;
+    char* ptr = buf->reserve(n_items * 11 + suffix.size() + 8);
+    for (size_t i = 0; i < n_items; i++) {
+        ptr = write_uint(ptr, item_ids[items[i]]);
+        *ptr++ = ',';
+    }
+    ptr--;
+    memcpy(ptr, suffix.data(), suffix.size());
+    ptr += suffix.size();
+    uint64_t sup_str = supportString(cnt);
+    memcpy(ptr, &sup_str, 8);
+    size_t line_begin = buf->size;
+    buf->size = ptr + 8 - buf->data;
+    METRICS_ADD(metrics.local().n_bytes, buf->size - line_begin);
+    if (higher != NULL)
+        forward(out, buf->data + line_begin, buf->size - line_begin, cnt);
+    flush(out);
+}
+
+void PatternWriter::writeLine(OutStream& out, const char* str, size_t len, const std::string& suffix, const int& cnt, const uint64_t& sup_str) {
+    METRICS_START(format);
+    // summaries of OUTPUT_TOPK are written as lines too, but were counted already
+    if (mode == OUTPUT_PATTERNS)
+        METRICS_ADD(metrics.local().n_patterns, 1);
+    if (binary) {
+        out.record.assign(str, len);
+        out.record += suffix;
+        writeRecord(out, cnt);
+        METRICS_ACCUM(format, metrics.local().format_ticks);
+        return;
+    }
+    // skip leading comma
+    OutBuf* buf = out.buf;
+    char* ptr = buf->reserve(len - 1 + suffix.size() + 8);
+    memcpy(ptr, str + 1, len - 1);
+    ptr += len - 1;
+    memcpy(ptr, suffix.data(), suffix.size());
+    ptr += suffix.size();
+    memcpy(ptr, &sup_str, 8);
+    size_t line_begin = buf->size;
+    buf->size = ptr + 8 - buf->data;
+    METRICS_ADD(metrics.local().n_bytes, buf->size - line_begin);
+    if (higher != NULL)
+        forward(out, buf->data + line_begin, buf->size - line_begin, cnt);
+    flush(out);
+    METRICS_ACCUM(format, metrics.local().format_ticks);
+}
+
+void PatternWriter::forward(OutStream& out, const char* line, size_t len, const int& cnt) {
+    size_t tid = &out - outs.data();
+    for (PatternWriter* writer = higher; writer != NULL && cnt >= writer->min_sup; writer = writer->higher) {
+        OutStream& other = writer->outs[tid];
+        memcpy(other.buf->reserve(len), line, len);
+        other.buf->size += len;
+        writer->flush(other);
+    }
+}
+
+void PatternWriter::format(std::string& str, const Item* items, size_t n_items) {
+    char tmp[11];
+    for (size_t i = 0; i < n_items; i++) {
+        if (binary) {
+            str.append(tmp, write_varint(tmp, items[i]) - tmp);
+        } else {
+            str += ',';
+            str.append(tmp, write_uint(tmp, item_ids[items[i]]) - tmp);
+        }
+    }
+}
+
+void PatternWriter::writeHeader() {
+    if (!binary)
+        return;
+    OutBuf* buf = new OutBuf(-1);
+    uint32_t flags = compressed ? 1 : 0, n_ranks = item_ids.size();
+    uint64_t n_trxns = trxns_size;
+    char* ptr = buf->reserve(24 + 4 * item_ids.size());
+    memcpy(ptr, PATTERNMAGIC, 8);
+    memcpy(ptr + 8, &flags, 4);
+    memcpy(ptr + 12, &n_ranks, 4);
+    memcpy(ptr + 16, &n_trxns, 8);
+    for (size_t i = 0; i < item_ids.size(); i++) {
+        uint32_t id = item_ids[i];
+        memcpy(ptr + 24 + 4 * i, &id, 4);
+    }
+    buf->size = 24 + 4 * item_ids.size();
+    // first in the queue, so first in the file
+    submit(buf);
+}
+
+void PatternWriter::writeRecord(OutStream& out, const int& cnt) {
+    const std::string& pattern = out.record;
+    size_t tid = &out - outs.data();
+    for (PatternWriter* writer = this; writer != NULL && cnt >= writer->min_sup; writer = writer->higher) {
+        // each buffer is decoded on its own, so its first record shares nothing
+        OutStream& own = writer->outs[tid];
+        OutBuf* buf = own.buf;
+        if (buf->size == 0)
+            own.prev.clear();
+        size_t shared = 0, max_shared = std::min(pattern.size(), own.prev.size());
+        while (shared < max_shared && own.prev[shared] == pattern[shared])
+            shared++;
+        char* ptr = buf->reserve(pattern.size() - shared + 15);
+        ptr = write_varint(ptr, shared);
+        ptr = write_varint(ptr, pattern.size() - shared);
+        memcpy(ptr, pattern.data() + shared, pattern.size() - shared);
+        ptr = write_varint(ptr + pattern.size() - shared, cnt);
+        if (writer == this)
+            METRICS_ADD(metrics.local().n_bytes, ptr - buf->data - buf->size);
+        buf->size = ptr - buf->data;
+        own.prev.assign(pattern);
+        writer->flush(own);
+    }
+}
+
+void PatternWriter::compress(OutBuf* buf) {
+#ifdef FPZLIB
+    if (!compressed || buf->size == 0)
+        return;
+    uLongf len = compressBound(buf->size);
+    char* data = (char*)malloc(len + 8);
+    // the bound always fits, so it only fails without memory
+    if (::compress2((Bytef*)data + 8, &len, (const Bytef*)buf->data, buf->size, Z_BEST_SPEED) != Z_OK)
+        throw std::bad_alloc();
+    uint32_t raw_len = buf->size, packed_len = len;
+    memcpy(data, &raw_len, 4);
+    memcpy(data + 4, &packed_len, 4);
+    free(buf->data);
+    buf->data = data;
+    buf->size = buf->cap = len + 8;
+#else
+    (void)buf;
+#endif  // FPZLIB
+}
+
+void PatternWriter::flush(OutStream& out) {
+    if (out.buf->size < MAXOSSBUF)
+        return;
+    if (segmented()) {
+        seal(out, out.buf->owner);
+        std::lock_guard<std::mutex> lock(seg_mutex);
+        drain();
+    } else {
+        compress(out.buf);
+        submit(out.buf);
+        out.buf = acquire(out, out.buf->owner);
+    }
+}
+
+Segment* PatternWriter::fork(OutStream& out) {
+    if (!segmented())
+        return NULL;
+    int tid = &out - outs.data();
+    Segment* first = NULL;
+    Segment** link = &first;
+    for (PatternWriter* writer = this; writer != NULL; writer = writer->higher) {
+        OutStream& other = writer->outs[tid];
+        Segment* seg = new Segment();
+        writer->seal(other, tid);
+        {
+            std::lock_guard<std::mutex> lock(writer->seg_mutex);
+            (other.seg != NULL ? other.seg : &writer->root)->pieces.emplace_back((OutBuf*)NULL, seg);
+        }
+        *link = seg;
+        link = &seg->higher;
+    }
+    return first;
+}
+
+void PatternWriter::enter(Segment* seg) {
+    int tid = omp_get_thread_num();
+    for (PatternWriter* writer = this; writer != NULL; writer = writer->higher, seg = seg->higher) {
+        // lines in the buffer were written by the interrupted task after its last fork
+        OutStream& out = writer->outs[tid];
+        writer->seal(out, tid);
+        seg->saved = out.seg;
+        out.seg = seg;
+    }
+}
+
+void PatternWriter::leave(Segment* seg) {
+    int tid = omp_get_thread_num();
+    for (PatternWriter* writer = this; writer != NULL; writer = writer->higher) {
+        OutStream& out = writer->outs[tid];
+        writer->seal(out, tid);
+        out.seg = seg->saved;
+        // seg is freed once written
+        Segment* next = seg->higher;
+        {
+            std::lock_guard<std::mutex> lock(writer->seg_mutex);
+            seg->done = true;
+            writer->drain();
+        }
+        seg = next;
+    }
+}
+
+void PatternWriter::seal(OutStream& out, const int& owner) {
+    if (out.buf->size == 0)
+        return;
+    compress(out.buf);
+    std::unique_lock<std::mutex> lock(seg_mutex);
+    OutBuf* piece = out.buf;
+    if (n_held + piece->size > MAXHELDBYTES && (spill.file != NULL || spill.open()) &&
+        pwrite(fileno(spill.file), piece->data, piece->size, spill_end) == (ssize_t)piece->size) {
+        // only the place in the spill file is kept, the buffer is reused
+        piece = new OutBuf(-1);
+        piece->size = out.buf->size;
+        piece->spilled = spill_end;
+        spill_end += piece->size;
+        out.buf->size = 0;
+    } else if (piece->size < MAXOSSBUF) {
+        // exact copy freed by the writer thread
+        piece = new OutBuf(-1);
+        piece->data = (char*)malloc(out.buf->size);
+        piece->size = piece->cap = out.buf->size;
+        memcpy(piece->data, out.buf->data, out.buf->size);
+        out.buf->size = 0;
+        n_held += piece->size;
+    } else {
+        n_held += piece->size;
+        lock.unlock();
+        out.buf = acquire(out, owner);
+        lock.lock();
+    }
+    (out.seg != NULL ? out.seg : &root)->pieces.emplace_back(piece, (Segment*)NULL);
+}
+
+void PatternWriter::drain() {
+    while (!cursor.empty()) {
+        Segment* seg = cursor.back().first;
+        size_t i = cursor.back().second;
+        if (i < seg->pieces.size()) {
+            cursor.back().second++;
+            auto [buf, child] = seg->pieces[i];
+            if (buf != NULL) {
+                if (buf->spilled < 0)
+                    n_held -= buf->size;
+                submit(buf);
+            } else
+                cursor.emplace_back(child, 0);
+        } else if (seg->done) {
+            if (seg != &root)
+                delete seg;
+            cursor.pop_back();
+        } else {
+            break;
+        }
+    }
+}
+
+uint64_t PatternWriter::formatSupport(const int& cnt) {
+    char str[16];
+    snprintf(str, sizeof(str), ":%.4f\n", (double)cnt / trxns_size);
+    uint64_t sup_str;
+    memcpy(&sup_str, str, 8);
+    return sup_str;
+}
+
+OutBuf* PatternWriter::acquire(OutStream& out, int owner) {
+    if (out.spare == NULL)
+        out.spare = out.free_bufs.exchange(NULL, std::memory_order_acquire);
+    if (out.spare == NULL) {
+        // segmented buffers wait for other tasks, so waiting for them could deadlock
+        if (out.owned.size() < MAXOUTBUFS || segmented()) {
+            out.owned.emplace_back(new OutBuf(owner));
+            return out.owned.back().get();
+        }
+        METRICS_START(blocked);
+        while (out.spare == NULL) {
+            out.free_bufs.wait(NULL, std::memory_order_acquire);
+            out.spare = out.free_bufs.exchange(NULL, std::memory_order_acquire);
+        }
+        METRICS_ACCUM(blocked, metrics.threads[owner].blocked_ticks);
+    }
+    OutBuf* buf = out.spare;
+    out.spare = buf->next;
+    buf->size = 0;
+    return buf;
+}
+
+void PatternWriter::submit(OutBuf* buf) {
+    buf->next = full_bufs.load(std::memory_order_relaxed);
+    while (!full_bufs.compare_exchange_weak(buf->next, buf, std::memory_order_release, std::memory_order_relaxed))
+        ;
+    full_bufs.notify_one();
+}
+
+void PatternWriter::ioLoop() {
+    std::vector<OutBuf*> batch;
+    std::vector<struct iovec> iov;
+    std::vector<char> chunk;  // lines read back from the spill file
+    bool stopped = false;
+    while (!stopped) {
+        full_bufs.wait(NULL, std::memory_order_acquire);
+        OutBuf* list = full_bufs.exchange(NULL, std::memory_order_acquire);
+        // stack order is newest first
+        batch.clear();
+        for (; list != NULL; list = list->next)
+            batch.emplace_back(list);
+        std::reverse(batch.begin(), batch.end());
+
+        METRICS_START(io);
+        for (OutBuf* buf : batch) {
+            if (buf == &stop) {
+                stopped = true;
+            } else if (buf->spilled >= 0) {
+                writeIov(iov);
+                copySpilled(buf, chunk);
+            } else if (buf->size > 0) {
+                iov.push_back({buf->data, buf->size});
+            }
+        }
+        writeIov(iov);
+        METRICS_ACCUM(io, io_ticks);
+
+        // return buffers to their owners, copies of sealed pieces have none
+        for (OutBuf* buf : batch) {
+            if (buf == &stop)
+                continue;
+            if (buf->owner < 0) {
+                delete buf;
+                continue;
+            }
+            std::atomic<OutBuf*>& free_bufs = outs[buf->owner].free_bufs;
+            buf->next = free_bufs.load(std::memory_order_relaxed);
+            while (!free_bufs.compare_exchange_weak(buf->next, buf, std::memory_order_release, std::memory_order_relaxed))
+                ;
+            free_bufs.notify_one();
+        }
+    }
+}
+
+void PatternWriter::writeIov(std::vector<struct iovec>& iov) {
+    // writev may write partially and takes at most IOV_MAX buffers
+    for (size_t i = 0; i < iov.size();) {
+        ssize_t len = writev(fd, iov.data() + i, std::min(iov.size() - i, (size_t)IOV_MAX));
+        if (len < 0) {
+            perror("write");
+            break;
+        }
+        n_written += len;
+        for (; i < iov.size() && (size_t)len >= iov[i].iov_len; i++)
+            len -= iov[i].iov_len;
+        if (i < iov.size()) {
+            iov[i].iov_base = (char*)iov[i].iov_base + len;
+            iov[i].iov_len -= len;
+        }
+    }
+    iov.clear();
+}
+
+void PatternWriter::copySpilled(const OutBuf* buf, std::vector<char>& chunk) {
+    chunk.resize(MAXOSSBUF);
+    std::vector<struct iovec> iov;
+    for (size_t done = 0; done < buf->size;) {
+        ssize_t len = pread(fileno(spill.file), chunk.data(), std::min(buf->size - done, chunk.size()), buf->spilled + done);
+        if (len <= 0) {
+            perror("read spill");
+            return;
+        }
+        iov.push_back({chunk.data(), (size_t)len});
+        writeIov(iov);
+        done += len;
+    }
+}
+
+void PatternWriter::summarize() {
+    OutStream& out = outs[0];
+    if (mode == OUTPUT_COUNT) {
+        for (size_t i = 1; i < outs.size(); i++)
+            count(out, outs[i].n_patterns);
+        std::string line = std::to_string(out.n_patterns) + "\n";
+        char* ptr = out.buf->reserve(line.size());
+        memcpy(ptr, line.data(), line.size());
+        out.buf->size += line.size();
+    } else if (mode == OUTPUT_TOPK) {
+        std::vector<std::pair<int, std::string>> top;
+        for (auto& other : outs) {
+            top.insert(top.end(), std::make_move_iterator(other.top.begin()), std::make_move_iterator(other.top.end()));
+            other.top.clear();
+        }
+        std::sort(top.begin(), top.end(), [](const std::pair<int, std::string>& x, const std::pair<int, std::string>& y) {
+            return x.first != y.first ? x.first > y.first : x.second < y.second;
+        });
+        top.resize(std::min(top.size(), (size_t)top_k));
+        for (auto& [cnt, line] : top)
+            writeLine(out, line.data(), line.size(), std::string(), cnt, supportString(cnt));
+    } else if (closedOnly()) {
+        std::vector<std::pair<int, Transaction>> cands;
+        for (auto& other : outs) {
+            cands.insert(cands.end(), std::make_move_iterator(other.cands.begin()), std::make_move_iterator(other.cands.end()));
+            other.cands.clear();
+        }
+        filterCandidates(cands);
+        for (auto& [cnt, items] : cands)
+            writePattern(out, items.data(), items.size(), std::string(), cnt);
+    }
+}
+
+void PatternWriter::filterCandidates(std::vector<std::pair<int, Transaction>>& cands) {
+    std::sort(cands.begin(), cands.end(), [](const std::pair<int, Transaction>& x, const std::pair<int, Transaction>& y) {
+        return x.second < y.second;
+    });
+    cands.erase(std::unique(cands.begin(), cands.end()), cands.end());
+
+    // candidates containing each item
+    std::vector<std::vector<uint32_t>> occs(item_ids.size());
+    for (size_t c = 0; c < cands.size(); c++) {
+        for (Item item : cands[c].second)
+            occs[item].emplace_back(c);
+    }
+    std::vector<char> keep(cands.size(), 1);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (size_t c = 0; c < cands.size(); c++) {
+        const Transaction& items = cands[c].second;
+        if (items.empty())
+            continue;
+        // supersets of c contain its least common item
+        Item rarest = *std::min_element(items.begin(), items.end(), [&](Item x, Item y) { return occs[x].size() < occs[y].size(); });
+        for (uint32_t d : occs[rarest]) {
+            const Transaction& other = cands[d].second;
+            if (other.size() > items.size() && (mode == OUTPUT_MAXIMAL || cands[d].first == cands[c].first) &&
+                std::includes(other.begin(), other.end(), items.begin(), items.end())) {
+                keep[c] = 0;
+                break;
+            }
+        }
+    }
+    size_t n_kept = 0;
+    for (size_t c = 0; c < cands.size(); c++) {
+        if (keep[c])
+            std::swap(cands[n_kept++], cands[c]);
+    }
+    cands.resize(n_kept);
+}
+
+void PatternWriter::close() {
+    if (fd < 0)
         return;
-    for (auto child : node->child)
-        deleteTree(child.second);
-    delete node;
-}
-
-void read_transactions(const std::string& input_filename, std::vector<Transaction>& trxns, FPTree& fptree) {
-    std::ifstream input_file(input_filename);
-    std::string str;
-    trxns.reserve(MAXTRXNS);
-    if (input_file.is_open()) {
-        while (getline(input_file, str)) {
-            Transaction trxn;
-            trxn.reserve(MAXTRXN);
-            size_t start = 0;
-            size_t end = str.find(',');
-
-            while (true) {
-                Item item = std::stoi(str.substr(start, end - start));
-                trxn.emplace_back(item);
-                fptree.item_freq[item]++;
-                if (end == std::string::npos)
-                    break;
-                start = end + 1;
-                end = str.find(',', start);
+    // every pattern is routed by now, each writer summarizes its own
+    PatternWriter* next = higher;
+    higher = NULL;
+    summarize();
+    if (segmented()) {
+        for (int i = 0; i < (int)outs.size(); i++)
+            seal(outs[i], i);
+        std::lock_guard<std::mutex> lock(seg_mutex);
+        root.done = true;
+        drain();
+    }
+    for (auto& out : outs) {
+        if (out.buf->size > 0) {
+            compress(out.buf);
+            submit(out.buf);
+        }
+    }
+    submit(&stop);
+    io_thread.join();
+    ::close(fd);
+    fd = -1;
+
+    DEBUG_MSG("Output: " << n_written << " bytes");
+    METRICS_ADD(metrics.n_written, n_written);
+    METRICS_ADD(metrics.io_ticks, io_ticks);
+    if (next != NULL)
+        next->close();
+}
+
+bool Snapshot::isSnapshot(const std::string& filename) {
+    char magic[8] = {};
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    size_t n_read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return n_read == sizeof(magic) && memcmp(magic, SNAPSHOTMAGIC, sizeof(magic)) == 0;
+}
+
+bool Snapshot::open(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+    size = st.st_size;
+    data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        data = NULL;
+        return false;
+    }
+    hdr = (const SnapshotHeader*)data;
+
+    // sections in file order
+    auto pad = [](size_t bytes) { return (bytes + 7) & ~(size_t)7; };
+    size_t pos = sizeof(SnapshotHeader);
+    item_ids = (const Item*)(data + pos);
+    pos += pad(hdr->n_ranks * sizeof(Item));
+    rank_freq = (const int*)(data + pos);
+    pos += pad(hdr->n_ranks * sizeof(int));
+    offsets = (const uint64_t*)(data + pos);
+    pos += pad((hdr->n_trxns + 1) * sizeof(uint64_t));
+    items = (const Item*)(data + pos);
+    pos += pad(hdr->n_occurs * sizeof(Item));
+    tree_block = (const uint32_t*)(data + pos);
+    pos += pad((4 * hdr->n_nodes + hdr->n_heads) * sizeof(uint32_t));
+    return pos <= size;
+}
+
+void Snapshot::loadRanks(std::vector<Item>& item_ids, std::vector<int>& rank_freq) const {
+    item_ids.assign(this->item_ids, this->item_ids + hdr->n_ranks);
+    rank_freq.assign(this->rank_freq, this->rank_freq + hdr->n_ranks);
+}
+
+void Snapshot::loadTrxns(Transactions& trxns) const {
+    trxns.offsets.assign(offsets, offsets + hdr->n_trxns + 1);
+    trxns.items.assign(items, items + hdr->n_occurs);
+}
+
+bool save_snapshot(const std::string& filename, const Transactions& trxns, const std::vector<Item>& item_ids, const std::vector<int>& rank_freq,
+                   const FrozenTree* tree, const int& floor, const bool& single_path) {
+    // written to a temporary file first, the old snapshot may still be mapped
+    std::string tmp_filename = filename + ".tmp";
+    FILE* file = fopen(tmp_filename.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    SnapshotHeader hdr = {};
+    memcpy(hdr.magic, SNAPSHOTMAGIC, sizeof(hdr.magic));
+    hdr.n_trxns = trxns.size();
+    hdr.n_ranks = item_ids.size();
+    hdr.n_occurs = trxns.items.size();
+    hdr.floor = tree != NULL ? floor : 0;
+    hdr.n_nodes = tree != NULL ? tree->n_nodes : 0;
+    hdr.n_heads = tree != NULL ? tree->n_heads : 0;
+    hdr.single_path = tree != NULL && single_path;
+    hdr.ranked = std::is_sorted(rank_freq.begin(), rank_freq.end(), [](int x, int y) { return x > y; });
+
+    // write section padded to 8 bytes
+    bool ok = true;
+    auto section = [&](const void* ptr, size_t bytes) {
+        static const char zeros[8] = {};
+        ok = ok && fwrite(ptr, 1, bytes, file) == bytes && fwrite(zeros, 1, (8 - bytes % 8) % 8, file) == (8 - bytes % 8) % 8;
+    };
+    std::vector<uint64_t> offsets(trxns.offsets.begin(), trxns.offsets.end());
+    section(&hdr, sizeof(hdr));
+    section(item_ids.data(), item_ids.size() * sizeof(Item));
+    section(rank_freq.data(), rank_freq.size() * sizeof(int));
+    section(offsets.data(), offsets.size() * sizeof(uint64_t));
+    section(trxns.items.data(), trxns.items.size() * sizeof(Item));
+    if (tree != NULL)
+        section(tree->data(), tree->words() * sizeof(uint32_t));
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        unlink(tmp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool read_transactions(const std::string& input_filename, Transactions& trxns, IdMap<int>& item_freq, const int& n_cpus) {
+    // a file that can not be read has no transactions
+    int fd = open(input_filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return true;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    size_t size = st.st_size;
+    const char* data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return true;
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+    const char* end = data + size;
+
+    int n_chunks = std::max(1, std::min(n_cpus, (int)(size / MINPARSECHUNK)));
+    if (n_chunks == 1) {
+        bool ok = parse_transactions(data, end, trxns, item_freq);
+        munmap((void*)data, size);
+        return ok;
+    }
+
+    // each chunk starts right after a newline
+    std::vector<const char*> bounds(n_chunks + 1, end);
+    bounds[0] = data;
+    for (int i = 1; i < n_chunks; i++) {
+        const char* ptr = std::max(data + size * i / n_chunks - 1, bounds[i - 1]);
+        const char* newline = (const char*)memchr(ptr, '\n', end - ptr);
+        bounds[i] = newline != NULL ? newline + 1 : end;
+    }
+
+    std::vector<Transactions> chunk_trxns(n_chunks);
+    std::vector<IdMap<int>> chunk_freq(n_chunks);
+    std::vector<char> chunk_ok(n_chunks);
+#pragma omp parallel for num_threads(n_chunks) schedule(static, 1)
+    for (int i = 0; i < n_chunks; i++) {
+        chunk_ok[i] = parse_transactions(bounds[i], bounds[i + 1], chunk_trxns[i], chunk_freq[i]);
+    }
+    munmap((void*)data, size);
+    if (std::find(chunk_ok.begin(), chunk_ok.end(), false) != chunk_ok.end())
+        return false;
+
+    // concatenate chunks
+    std::vector<size_t> item_base(n_chunks + 1, 0), trxn_base(n_chunks + 1, 0);
+    size_t n_ids = 0;
+    for (int i = 0; i < n_chunks; i++) {
+        item_base[i + 1] = item_base[i] + chunk_trxns[i].items.size();
+        trxn_base[i + 1] = trxn_base[i] + chunk_trxns[i].size();
+        n_ids = std::max(n_ids, chunk_freq[i].dense.size());
+    }
+    trxns.items.resize(item_base[n_chunks]);
+    trxns.offsets.resize(trxn_base[n_chunks] + 1);
+#pragma omp parallel for num_threads(n_chunks) schedule(static, 1)
+    for (int i = 0; i < n_chunks; i++) {
+        std::copy(chunk_trxns[i].items.begin(), chunk_trxns[i].items.end(), trxns.items.begin() + item_base[i]);
+        for (size_t j = 1; j < chunk_trxns[i].offsets.size(); j++)
+            trxns.offsets[trxn_base[i] + j] = chunk_trxns[i].offsets[j] + item_base[i];
+        chunk_trxns[i] = Transactions();
+    }
+
+    // reduce frequency histograms, few ids are sparse
+    item_freq.dense.assign(n_ids, 0);
+#pragma omp parallel for num_threads(n_chunks) schedule(static)
+    for (size_t item = 0; item < n_ids; item++) {
+        for (int i = 0; i < n_chunks; i++) {
+            if (item < chunk_freq[i].dense.size())
+                item_freq.dense[item] += chunk_freq[i].dense[item];
+        }
+    }
+    for (int i = 0; i < n_chunks; i++) {
+        for (auto& [id, freq] : chunk_freq[i].sparse)
+            item_freq[id] += freq;
+    }
+    return true;
+}
+
+bool parse_transactions(const char* ptr, const char* end, Transactions& trxns, IdMap<int>& item_freq) {
+    // every item takes at least two bytes, untouched capacity is never paged in
+    trxns.items.reserve((end - ptr) / 2 + 1);
+    while (ptr < end) {
+        // parse one line
+        while (ptr < end && *ptr != '\n') {
+            uint64_t item = 0;
+            bool has_digit = false;
+            for (; ptr < end && (unsigned)(*ptr - '0') < 10; ptr++) {
+                item = item * 10 + (*ptr - '0');
+                has_digit = true;
+                // checked per digit, so item never overflows
+                if (item > UINT32_MAX)
+                    return false;
+            }
+            if (has_digit) {
+                trxns.items.emplace_back((Item)(uint32_t)item);
+                item_freq[item]++;
             }
-            trxns.emplace_back(trxn);
+            // skip separator, or carriage return
+            if (ptr < end && *ptr != '\n')
+                ptr++;
+        }
+        ptr++;
+        trxns.offsets.emplace_back(trxns.items.size());
+    }
+    return true;
+}
+
+void remap_transactions(Transactions& trxns, const IdMap<int>& item_freq, std::vector<Item>& item_ids, std::vector<int>& rank_freq) {
+    std::vector<std::pair<int, uint32_t>> ids;
+    item_freq.forEach([&](uint32_t id, int freq) {
+        if (freq > 0)
+            ids.emplace_back(freq, id);
+    });
+    std::sort(ids.begin(), ids.end(), rank_order);
+
+    IdMap<Item> rank_of(-1);
+    item_ids.resize(ids.size());
+    rank_freq.resize(ids.size());
+    for (Item rank = 0; rank < (int)ids.size(); rank++) {
+        rank_of[ids[rank].second] = rank;
+        item_ids[rank] = ids[rank].second;
+        rank_freq[rank] = ids[rank].first;
+    }
+
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < trxns.size(); i++) {
+        for (Item* item = trxns.begin(i); item != trxns.end(i); item++)
+            *item = rank_of.get(*item);
+        std::sort(trxns.begin(i), trxns.end(i));
+    }
+}
+
+void append_transactions(Transactions& trxns, std::vector<Item>& item_ids, std::vector<int>& rank_freq, Transactions& delta, const IdMap<int>& delta_freq) {
+    IdMap<Item> rank_of(-1);
+    for (Item rank = 0; rank < (int)item_ids.size(); rank++)
+        rank_of[item_ids[rank]] = rank;
+
+    // new items are ranked among themselves
+    std::vector<std::pair<int, uint32_t>> new_ids;
+    delta_freq.forEach([&](uint32_t id, int freq) {
+        if (freq > 0 && rank_of.get(id) < 0)
+            new_ids.emplace_back(freq, id);
+    });
+    std::sort(new_ids.begin(), new_ids.end(), rank_order);
+    for (auto& [freq, id] : new_ids) {
+        rank_of[id] = item_ids.size();
+        item_ids.emplace_back(id);
+        rank_freq.emplace_back(0);
+    }
+    delta_freq.forEach([&](uint32_t id, int freq) {
+        if (freq > 0)
+            rank_freq[rank_of.get(id)] += freq;
+    });
+
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < delta.size(); i++) {
+        for (Item* item = delta.begin(i); item != delta.end(i); item++)
+            *item = rank_of.get(*item);
+        std::sort(delta.begin(i), delta.end(i));
+    }
+    size_t item_base = trxns.items.size();
+    trxns.items.insert(trxns.items.end(), delta.items.begin(), delta.items.end());
+    for (size_t i = 1; i < delta.offsets.size(); i++)
+        trxns.offsets.emplace_back(item_base + delta.offsets[i]);
+}
+
+template <typename Fn>
+bool stream_transactions(const std::string& input_filename, IdMap<int>& item_freq, Fn fn) {
+    int fd = open(input_filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<char> buf(STREAMCHUNK);
+    size_t filled = 0;
+    Transactions chunk;
+    bool more = true, eof = false;
+    while (more && !eof) {
+        // a line longer than the buffer grows it
+        if (filled == buf.size())
+            buf.resize(2 * buf.size());
+        ssize_t n = read(fd, buf.data() + filled, buf.size() - filled);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            close(fd);
+            return false;
+        }
+        filled += n;
+
+        // parse complete lines, the last partial line waits for the next read unless the file ended
+        const char* end = buf.data() + filled;
+        if (n > 0) {
+            const char* newline = (const char*)memrchr(buf.data(), '\n', filled);
+            end = newline != NULL ? newline + 1 : buf.data();
+        } else {
+            eof = true;
+        }
+        chunk.offsets.assign(1, 0);
+        chunk.items.clear();
+        if (!parse_transactions(buf.data(), end, chunk, item_freq)) {
+            close(fd);
+            return false;
+        }
+        for (size_t i = 0; i < chunk.size() && more; i++)
+            more = fn(chunk.begin(i), chunk.end(i));
+
+        filled -= end - buf.data();
+        memmove(buf.data(), end, filled);
+    }
+    close(fd);
+    return true;
+}
+
+bool stream_fpgrowth(const std::string& input_filename, const std::vector<Item>& item_ids, const std::vector<int>& rank_freq, const int& n_items,
+                     const int& min_sup, const size_t& budget, PatternWriter& writer, const int& n_cpus) {
+    // ids not counted in the first pass are pruned
+    IdMap<Item> rank_of(n_items);
+    for (Item rank = 0; rank < n_items; rank++)
+        rank_of[item_ids[rank]] = rank;
+    IdMap<int> scratch_freq;
+    auto prune = [&](Item* begin, Item* end) {
+        for (Item* item = begin; item != end; item++)
+            *item = rank_of.get(*item);
+        std::sort(begin, end);
+        return std::lower_bound(begin, end, n_items);
+    };
+
+    // the whole tree while it fits the budget
+    {
+        FPTree fptree(n_items, item_ids);
+        fptree.countRanks(rank_freq, min_sup);
+        std::vector<FPNode*> tail_table(n_items, NULL);
+        bool fits = true;
+        bool streamed = stream_transactions(input_filename, scratch_freq, [&](Item* begin, Item* end) {
+            fptree.insertPath(begin, prune(begin, end), tail_table, 1);
+            return fits = fptree.arena.n_bytes <= budget;
+        });
+        if (!streamed)
+            return false;
+        if (fits) {
+            fptree.freeze();
+            fptree.fpgrowth(writer, min_sup, n_cpus);
+            return true;
+        }
+        DEBUG_MSG("Tree exceeds " << budget << " bytes, mining partitions");
+    }
+
+    // partition b holds ranks [bounds[b], bounds[b + 1]), about equal shares of occurrences
+    double n_occurs = std::accumulate(rank_freq.begin(), rank_freq.begin() + n_items, 0.0);
+    std::vector<Item> bounds{0};
+    std::vector<int> part_of(n_items);
+    double occurs = 0;
+    for (Item rank = 0; rank < n_items; rank++) {
+        if (occurs >= n_occurs * bounds.size() / STREAMPARTS)
+            bounds.emplace_back(rank);
+        part_of[rank] = bounds.size() - 1;
+        occurs += rank_freq[rank];
+    }
+    bounds.emplace_back(n_items);
+    int n_parts = bounds.size() - 1;
+
+    // third pass, each transaction goes to the partition of its last rank
+    std::vector<SpillFile> parts(n_parts);
+    for (SpillFile& part : parts) {
+        if (!part.open())
+            return false;
+    }
+    bool streamed = stream_transactions(input_filename, scratch_freq, [&](Item* begin, Item* end) {
+        end = prune(begin, end);
+        if (begin != end)
+            parts[part_of[end[-1]]].write(begin, end);
+        return true;
+    });
+    if (!streamed)
+        return false;
+
+    // transactions containing a rank of partition b are all in it once later partitions passed them on
+    // the tree of b mines suffixes in b, then transactions move on without the ranks of b
+    for (int b = n_parts - 1; b >= 0; b--) {
+        FPTree fptree(bounds[b + 1], item_ids);
+        fptree.countRanks(rank_freq, min_sup);
+        std::vector<FPNode*> tail_table(bounds[b + 1], NULL);
+        bool drained = parts[b].drain([&](const Item* begin, const Item* end) {
+            fptree.insertPath(begin, end, tail_table, 1);
+            const Item* cut = std::lower_bound(begin, end, bounds[b]);
+            if (cut != begin)
+                parts[part_of[cut[-1]]].write(begin, cut);
+        });
+        if (!drained)
+            return false;
+        fptree.keepSuffixes(bounds[b]);
+        fptree.freeze();
+        fptree.fpgrowth(writer, min_sup, n_cpus);
+    }
+    return true;
+}
+
+bool SpillFile::open() {
+    const char* dir = getenv("TMPDIR");
+    std::string path = std::string(dir != NULL && *dir != '\0' ? dir : "/tmp") + "/fpspillXXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0)
+        return false;
+    // removed as soon as it is closed
+    unlink(path.c_str());
+    file = fdopen(fd, "w+b");
+    if (file == NULL) {
+        ::close(fd);
+        return false;
+    }
+    return true;
+}
+
+void SpillFile::write(const Item* begin, const Item* end) {
+    int len = end - begin;
+    fwrite(&len, sizeof(len), 1, file);
+    fwrite(begin, sizeof(Item), len, file);
+}
+
+template <typename Fn>
+bool SpillFile::drain(Fn fn) {
+    bool ok = fflush(file) == 0 && !ferror(file) && fseek(file, 0, SEEK_SET) == 0;
+    Transaction trxn;
+    int len;
+    while (ok && fread(&len, sizeof(len), 1, file) == 1) {
+        trxn.resize(len);
+        ok = fread(trxn.data(), sizeof(Item), len, file) == (size_t)len;
+        if (ok)
+            fn(trxn.data(), trxn.data() + len);
+    }
+    ok = ok && !ferror(file);
+    fclose(file);
+    file = NULL;
+    return ok;
+}
+
+Metrics::Metrics() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    start_ticks = __rdtsc();
+    start_time = now.tv_sec + now.tv_nsec / 1e9;
+}
+
+bool Metrics::dump(const std::string& filename) const {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL)
+        return false;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double secs_per_tick = (now.tv_sec + now.tv_nsec / 1e9 - start_time) / std::max<uint64_t>(__rdtsc() - start_ticks, 1);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // per depth totals of all threads
+    std::vector<DepthMetrics> depths;
+    for (const ThreadMetrics& thread : threads) {
+        depths.resize(std::max(depths.size(), thread.depths.size()));
+        for (size_t d = 0; d < thread.depths.size(); d++) {
+            depths[d].n_trees += thread.depths[d].n_trees;
+            depths[d].n_nodes += thread.depths[d].n_nodes;
+            depths[d].n_single_paths += thread.depths[d].n_single_paths;
+            depths[d].n_bases += thread.depths[d].n_bases;
+            depths[d].growth_ticks += thread.depths[d].growth_ticks;
+        }
+    }
+    auto dump_depths = [&](const std::vector<DepthMetrics>& depths, const char* indent) {
+        for (size_t d = 0; d < depths.size(); d++) {
+            fprintf(file, "%s{\"depth\": %zu, \"trees\": %lu, \"nodes\": %lu, \"single_paths\": %lu, \"bases\": %lu, \"growth_seconds\": %.6f}%s\n",
+                    indent, d, depths[d].n_trees, depths[d].n_nodes, depths[d].n_single_paths, depths[d].n_bases,
+                    depths[d].growth_ticks * secs_per_tick, d + 1 < depths.size() ? "," : "");
         }
-        input_file.close();
+    };
+
+    fprintf(file, "{\n  \"threads\": %zu,\n  \"peak_rss_kb\": %ld,\n  \"phases\": {\n", threads.size(), usage.ru_maxrss);
+    for (size_t i = 0; i < phases.size(); i++)
+        fprintf(file, "    \"%s\": %.6f%s\n", phases[i].first.c_str(), phases[i].second * secs_per_tick, i + 1 < phases.size() ? "," : "");
+    fprintf(file, "  },\n  \"output\": {\"bytes_written\": %lu, \"write_seconds\": %.6f},\n", n_written, io_ticks * secs_per_tick);
+    fprintf(file, "  \"arena\": {\"chunks_malloced\": %zu},\n  \"depths\": [\n", arena_stats.n_chunks.load());
+    dump_depths(depths, "    ");
+    fprintf(file, "  ],\n  \"per_thread\": [\n");
+    for (size_t t = 0; t < threads.size(); t++) {
+        const ThreadMetrics& thread = threads[t];
+        fprintf(file, "    {\"thread\": %zu, \"patterns\": %lu, \"bytes\": %lu, \"format_seconds\": %.6f, \"blocked_seconds\": %.6f, \"depths\": [\n",
+                t, thread.n_patterns, thread.n_bytes, thread.format_ticks * secs_per_tick, thread.blocked_ticks * secs_per_tick);
+        dump_depths(thread.depths, "      ");
+        fprintf(file, "    ]}%s\n", t + 1 < threads.size() ? "," : "");
     }
-}
\ No newline at end of file
+    fprintf(file, "  ]\n}\n");
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
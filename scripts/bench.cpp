@@ -0,0 +1,309 @@
+// Benchmark harness: generate seeded synthetic datasets and time the miner over supports and thread counts
+// usage: ./bench [--miner=PATH] [--trxns=N,...] [--items=N,...] [--length=MEAN,...] [--skew=S,...] [--seed=N]
+//                [--supports=S,...] [--threads=N,...] [--trials=N] [--args="MINER ARGS"] [--dir=DIR] [--out=FILE]
+//        ./bench --generate=FILE [--trxns=N] [--items=N] [--length=MEAN] [--skew=S] [--seed=N]
+// every dataset, support and thread count is one JSON line of results, patterns are null unless the output is text lines,
+// with --generate only the dataset of the first values is written to FILE
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Options {
+    std::string miner = "../109062131_hw1";
+    std::vector<double> trxns{100000};
+    std::vector<double> items{1000};
+    std::vector<double> lengths{10};  // mean transaction length
+    std::vector<double> skews{1.0};   // zipf exponent of item popularity, 0 is uniform
+    uint64_t seed = 1;
+    std::vector<double> supports{0.01, 0.02, 0.05};
+    std::vector<double> threads{1};
+    int trials = 3;
+    std::vector<std::string> args;  // extra arguments of the miner
+    std::string dir = "/tmp";       // where datasets and outputs are kept
+    std::string out;                // results file, stdout if empty
+    std::string generate;           // only write a dataset to this file
+};
+
+struct Dataset {
+    size_t n_trxns;
+    int n_items;
+    double length;
+    double skew;
+    std::string path;
+};
+
+// One run of the miner
+struct Trial {
+    double seconds;
+    long peak_rss_kb;
+};
+
+std::vector<double> parse_list(const std::string& str) {
+    std::vector<double> values;
+    std::stringstream ss(str);
+    std::string value;
+    while (std::getline(ss, value, ','))
+        values.emplace_back(atof(value.c_str()));
+    return values;
+}
+
+bool parse_options(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            return false;
+        std::string name = arg.substr(2, eq - 2), value = arg.substr(eq + 1);
+        if (name == "miner")
+            opts.miner = value;
+        else if (name == "trxns")
+            opts.trxns = parse_list(value);
+        else if (name == "items")
+            opts.items = parse_list(value);
+        else if (name == "length")
+            opts.lengths = parse_list(value);
+        else if (name == "skew")
+            opts.skews = parse_list(value);
+        else if (name == "seed")
+            opts.seed = strtoull(value.c_str(), NULL, 10);
+        else if (name == "supports")
+            opts.supports = parse_list(value);
+        else if (name == "threads")
+            opts.threads = parse_list(value);
+        else if (name == "trials")
+            opts.trials = atoi(value.c_str());
+        else if (name == "args") {
+            std::stringstream ss(value);
+            std::string word;
+            while (ss >> word)
+                opts.args.emplace_back(word);
+        } else if (name == "dir")
+            opts.dir = value;
+        else if (name == "out")
+            opts.out = value;
+        else if (name == "generate")
+            opts.generate = value;
+        else
+            return false;
+    }
+    return opts.trials > 0 && !opts.trxns.empty() && !opts.items.empty() && !opts.lengths.empty() && !opts.skews.empty();
+}
+
+// Write dataset to data.path, the seed is mixed with the parameters
+// so a dataset is the same whatever else is in the matrix
+bool write_dataset(const Dataset& data, const uint64_t& seed) {
+    std::seed_seq seq{seed, (uint64_t)data.n_trxns, (uint64_t)data.n_items, (uint64_t)(data.length * 1000), (uint64_t)(data.skew * 1000)};
+    std::mt19937_64 rng(seq);
+    // popularity of rank r is 1 / (r + 1)^skew, ranks are shuffled onto item ids
+    std::vector<double> cdf(data.n_items);
+    double sum = 0;
+    for (int r = 0; r < data.n_items; r++)
+        cdf[r] = sum += 1 / std::pow(r + 1, data.skew);
+    std::vector<int> ids(data.n_items);
+    for (int r = 0; r < data.n_items; r++)
+        ids[r] = r;
+    std::shuffle(ids.begin(), ids.end(), rng);
+
+    std::string tmp = data.path + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "w");
+    if (file == NULL)
+        return false;
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::poisson_distribution<int> poisson(std::max(data.length - 1, 0.0));
+    std::vector<int> trxn;
+    for (size_t i = 0; i < data.n_trxns; i++) {
+        // at least one item, at most the whole universe, items of a transaction are distinct
+        size_t len = std::min(1 + poisson(rng), data.n_items);
+        trxn.clear();
+        while (trxn.size() < len) {
+            int item = ids[std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin()];
+            if (std::find(trxn.begin(), trxn.end(), item) == trxn.end())
+                trxn.emplace_back(item);
+        }
+        for (size_t j = 0; j < trxn.size(); j++)
+            fprintf(file, j == 0 ? "%d" : ",%d", trxn[j]);
+        fputc('\n', file);
+    }
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    return ok && rename(tmp.c_str(), data.path.c_str()) == 0;
+}
+
+// Write dataset into dir unless a file of the same parameters exists
+bool generate(Dataset& data, const uint64_t& seed, const std::string& dir) {
+    char name[256];
+    snprintf(name, sizeof(name), "/bench_t%zu_i%d_l%g_s%g_seed%lu", data.n_trxns, data.n_items, data.length, data.skew, seed);
+    data.path = dir + name;
+    struct stat st;
+    return stat(data.path.c_str(), &st) == 0 || write_dataset(data, seed);
+}
+
+// Run miner with n_threads OpenMP threads, false if it does not exit with 0
+bool run(const Options& opts, const Dataset& data, const double& support, const int& n_threads, const std::string& output, Trial& trial) {
+    std::string support_str = std::to_string(support);
+    std::vector<char*> argv{(char*)opts.miner.c_str(), (char*)support_str.c_str(), (char*)data.path.c_str(), (char*)output.c_str()};
+    for (const std::string& arg : opts.args)
+        argv.emplace_back((char*)arg.c_str());
+    argv.emplace_back((char*)NULL);
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        // progress and debug lines of the miner are not part of the results
+        setenv("OMP_NUM_THREADS", std::to_string(n_threads).c_str(), 1);
+        if (freopen("/dev/null", "w", stdout) == NULL)
+            _exit(127);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return false;
+    trial.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    trial.peak_rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Lines and bytes of output file
+void count_output(const std::string& output, size_t& n_lines, size_t& n_bytes) {
+    n_lines = n_bytes = 0;
+    FILE* file = fopen(output.c_str(), "r");
+    if (file == NULL)
+        return;
+    char buf[1 << 16];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        n_bytes += len;
+        n_lines += std::count(buf, buf + len, '\n');
+    }
+    fclose(file);
+}
+
+// Output of the miner is one text line per pattern, not binary records, a count or top K
+bool pattern_lines(const std::vector<std::string>& args) {
+    for (const std::string& arg : args) {
+        if (arg.compare(0, 8, "--binary") == 0 || arg == "--count" || arg.compare(0, 6, "--top=") == 0)
+            return false;
+    }
+    return true;
+}
+
+// Quote str as a JSON string
+std::string json_string(const std::string& str) {
+    std::string quoted = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if ((unsigned char)c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            quoted += esc;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        std::cerr << "usage: " << argv[0] << " [--miner=PATH] [--trxns=N,...] [--items=N,...] [--length=MEAN,...] [--skew=S,...] [--seed=N]"
+                  << " [--supports=S,...] [--threads=N,...] [--trials=N] [--args=\"MINER ARGS\"] [--dir=DIR] [--out=FILE]\n"
+                  << "       " << argv[0] << " --generate=FILE [--trxns=N] [--items=N] [--length=MEAN] [--skew=S] [--seed=N]\n";
+        return 1;
+    }
+    if (!opts.generate.empty()) {
+        Dataset data{(size_t)opts.trxns[0], (int)opts.items[0], opts.lengths[0], opts.skews[0], opts.generate};
+        if (data.n_trxns == 0 || data.n_items <= 0 || !write_dataset(data, opts.seed)) {
+            std::cerr << "cannot generate dataset " << opts.generate << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    FILE* results = opts.out.empty() ? stdout : fopen(opts.out.c_str(), "w");
+    if (results == NULL) {
+        std::cerr << "cannot write " << opts.out << "\n";
+        return 1;
+    }
+    std::string args;
+    for (const std::string& arg : opts.args)
+        args += (args.empty() ? "" : " ") + arg;
+    args = json_string(args);
+    bool lines = pattern_lines(opts.args);
+
+    int n_failed = 0;
+    for (double n_trxns : opts.trxns) {
+        for (double n_items : opts.items) {
+            for (double length : opts.lengths) {
+                for (double skew : opts.skews) {
+                    Dataset data{(size_t)n_trxns, (int)n_items, length, skew, ""};
+                    if (data.n_trxns == 0 || data.n_items <= 0 || !generate(data, opts.seed, opts.dir)) {
+                        std::cerr << "cannot generate dataset in " << opts.dir << "\n";
+                        return 1;
+                    }
+                    std::string output = data.path + ".out";
+                    for (double support : opts.supports) {
+                        for (double threads : opts.threads) {
+                            std::vector<Trial> trials(opts.trials);
+                            bool ok = true;
+                            for (Trial& trial : trials)
+                                ok = ok && run(opts, data, support, threads, output, trial);
+                            if (!ok) {
+                                std::cerr << "miner failed on " << data.path << " at support " << support << " with " << threads << " threads\n";
+                                n_failed++;
+                                continue;
+                            }
+                            size_t n_patterns, n_bytes;
+                            count_output(output, n_patterns, n_bytes);
+
+                            std::sort(trials.begin(), trials.end(), [](const Trial& x, const Trial& y) { return x.seconds < y.seconds; });
+                            double median = trials.size() % 2 == 1 ? trials[trials.size() / 2].seconds
+                                                                   : (trials[trials.size() / 2 - 1].seconds + trials[trials.size() / 2].seconds) / 2;
+                            long peak_rss_kb = 0;
+                            for (const Trial& trial : trials)
+                                peak_rss_kb = std::max(peak_rss_kb, trial.peak_rss_kb);
+                            // newlines only count patterns of text output
+                            std::string patterns = "null", patterns_per_second = "null";
+                            if (lines) {
+                                char buf[32];
+                                patterns = std::to_string(n_patterns);
+                                snprintf(buf, sizeof(buf), "%.1f", n_patterns / median);
+                                patterns_per_second = buf;
+                            }
+                            fprintf(results,
+                                    "{\"trxns\": %zu, \"items\": %d, \"length\": %g, \"skew\": %g, \"seed\": %lu, \"support\": %g, \"threads\": %d, "
+                                    "\"args\": %s, \"trials\": %d, \"median_seconds\": %.6f, \"min_seconds\": %.6f, \"max_seconds\": %.6f, "
+                                    "\"patterns\": %s, \"bytes\": %zu, \"patterns_per_second\": %s, \"bytes_per_second\": %.1f, \"peak_rss_kb\": %ld}\n",
+                                    data.n_trxns, data.n_items, data.length, data.skew, opts.seed, support, (int)threads, args.c_str(), opts.trials,
+                                    median, trials.front().seconds, trials.back().seconds, patterns.c_str(), n_bytes, patterns_per_second.c_str(),
+                                    n_bytes / median, peak_rss_kb);
+                            fflush(results);
+                        }
+                    }
+                    unlink(output.c_str());
+                }
+            }
+        }
+    }
+    if (results != stdout)
+        fclose(results);
+    return n_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#!/bin/bash
+# Compare FPNode child containers (sibling list vs std::map)
+# usage: bash scripts/bench_child.sh {min_support} {testcase} [runs]
+min_support=$1
+input_filename=$2
+runs=${3:-3}
+
+# instrumented builds under their own names, the default build has no metrics
+make -s 109062131_hw1_metrics 109062131_hw1_map_metrics
+for exe in ./109062131_hw1_metrics ./109062131_hw1_map_metrics; do
+    echo "$exe"
+    for ((i = 0; i < runs; i++)); do
+        $exe $min_support testcases/$input_filename /dev/null --engine=tree --metrics=/dev/stdout | grep -E '"(build_fptree|total)"|peak_rss_kb' | tr '\n' ' '
+        echo
+    done
+done
@@ -0,0 +1,96 @@
+// Micro-benchmark of output formatting: ostringstream path vs PatternWriter
+// usage: ./bench_format [n_patterns]
+#define main hw1_main
+#include "../109062131_hw1.cpp"
+#undef main
+
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+const size_t TRXNS_SIZE = 100000;
+const int MIN_SUP = 1000;
+const int N_ITEMS = 1000;
+
+struct Pattern {
+    std::vector<Item> items;
+    int cnt;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Format pattern the way the miner did before PatternWriter
+void oss_write(std::ostringstream& oss, const std::vector<Item>& item_ids, const Pattern& pattern) {
+    oss << item_ids[pattern.items[0]];
+    for (size_t i = 1; i < pattern.items.size(); i++)
+        oss << ',' << item_ids[pattern.items[i]];
+    oss << std::fixed << std::setprecision(4) << ':' << (double)pattern.cnt / TRXNS_SIZE << '\n';
+}
+
+int main(int argc, char** argv) {
+    size_t n_patterns = argc > 1 ? atol(argv[1]) : 2000000;
+
+    std::mt19937 rng(0);
+    std::vector<Item> item_ids(N_ITEMS);
+    for (int i = 0; i < N_ITEMS; i++)
+        item_ids[i] = i;
+    std::shuffle(item_ids.begin(), item_ids.end(), rng);
+    std::vector<Pattern> patterns(n_patterns);
+    for (auto& pattern : patterns) {
+        pattern.items.resize(1 + rng() % 10);
+        for (auto& item : pattern.items)
+            item = rng() % N_ITEMS;
+        pattern.cnt = MIN_SUP + rng() % (TRXNS_SIZE - MIN_SUP + 1);
+    }
+
+    // both paths must produce the same bytes
+    {
+        std::ostringstream oss;
+        PatternWriter writer("/dev/null", item_ids, MIN_SUP, TRXNS_SIZE, 1);
+        OutStream& out = writer.outs[0];
+        for (size_t i = 0; i < std::min(n_patterns, (size_t)1000); i++) {
+            oss_write(oss, item_ids, patterns[i]);
+            writer.write(out, patterns[i].items.data(), patterns[i].items.size(), std::string(), patterns[i].cnt);
+        }
+        if (oss.str() != std::string(out.buf->data, out.buf->size)) {
+            std::cerr << "Err: formatted output differs\n";
+            return 1;
+        }
+    }
+
+    size_t n_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::ofstream output_file("/dev/null");
+        std::ostringstream oss;
+        for (auto& pattern : patterns) {
+            oss_write(oss, item_ids, pattern);
+            if (oss.tellp() >= MAXOSSBUF) {
+                std::string str = oss.str();
+                output_file.write(str.data(), str.size());
+                n_bytes += str.size();
+                oss.clear();
+                oss.str("");
+            }
+        }
+        n_bytes += oss.str().size();
+    }
+    double oss_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        PatternWriter writer("/dev/null", item_ids, MIN_SUP, TRXNS_SIZE, 1);
+        OutStream& out = writer.outs[0];
+        for (auto& pattern : patterns)
+            writer.write(out, pattern.items.data(), pattern.items.size(), std::string(), pattern.cnt);
+    }
+    double writer_time = seconds_since(start);
+
+    std::cout << n_patterns << " patterns, " << n_bytes << " bytes\n";
+    std::cout << "ostringstream: " << oss_time << "s, " << n_bytes / oss_time / 1e6 << "MB/s\n";
+    std::cout << "PatternWriter: " << writer_time << "s, " << n_bytes / writer_time / 1e6 << "MB/s\n";
+    return 0;
+}
@@ -1,184 +1,259 @@
+// Compare two frequent pattern outputs as sets of patterns, ignoring line and item order
+// usage: ./diff {expected} {actual}
+// each line is canonicalized into a hash of its sorted items and a fixed point support,
+// both files are memory mapped, parsed in parallel and compared partition by partition
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
-#include <cassert>
-#include <fstream>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <map>
-#include <unordered_map>
+#include <string>
 #include <vector>
 using namespace std;
 
-struct FrequentPatterns {
-    struct Node {
-        double freq;
-        std::unordered_map<int, Node*> child;
-        Node() : freq(-1) {}
-        Node(double freq) : freq(freq) {}
-        // return if current node is an end of frequent pattern
-        bool isfp() const {
-            return freq != -1;
-        }
-    };
+// partitions are picked by the top bits of the hash
+#define PARTITIONBITS 8
+#define NPARTITIONS (1 << PARTITIONBITS)
+// lines of each kind of mismatch printed
+#define MAXEXAMPLES 5
 
-    Node* root;
-    size_t _size;
+// Canonical form of one pattern line
+struct Entry {
+    uint64_t hash;   // hash of sorted items
+    uint32_t check;  // second hash of sorted items, so 96 bits tell patterns apart
+    uint32_t sup;    // support in millionths, rounded
+    uint64_t offset;  // start of the line in its file
 
-    FrequentPatterns() {
-        root = new Node();
-        _size = 0;
+    bool samePattern(const Entry& other) const {
+        return hash == other.hash && check == other.check;
     }
-    ~FrequentPatterns() {
-        deleteTree(root);
+    bool operator<(const Entry& other) const {
+        return hash != other.hash ? hash < other.hash : check < other.check;
     }
+};
 
-    void insert(const std::vector<int>& lst, double freq) {
-        Node* curr = root;
-        for (const auto& item : lst) {
-            auto it = curr->child.find(item);
-            if (it != curr->child.end()) {
-                curr = it->second;
-            } else {
-                Node* node = new Node();
-                curr = curr->child[item] = node;
-            }
-        }
-        if (curr->isfp()) {
-            cerr << "Err: Repeated frequent patterns\n";
-            exit(1);
-        }
+struct MappedFile {
+    const char* data = NULL;
+    size_t size = 0;
+    string name;
+    // entries of chunk c in partition p are parts[c][p]
+    vector<vector<vector<Entry>>> parts;
 
-        curr->freq = freq;
-        _size++;
+    ~MappedFile() {
+        if (data != NULL && size > 0)
+            munmap((void*)data, size);
     }
 
-    double pop(const std::vector<int>& lst) {
-        double retFreq = -1;
-        Node* curr = root;
-        for (const auto& item : lst) {
-            auto it = curr->child.find(item);
-            if (it != curr->child.end()) {
-                curr = it->second;
-            } else {
-                cerr << "Err: Pattern not matched \n";
-                exit(1);
-            }
+    bool open(const string& filename) {
+        name = filename;
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            return false;
         }
-        if (!curr->isfp()) {
-            cerr << "Err: Frequent pattern not exist\n";
-            exit(1);
+        size = st.st_size;
+        if (size > 0) {
+            data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+                data = NULL;
+            else
+                madvise((void*)data, size, MADV_SEQUENTIAL);
         }
-        retFreq = curr->freq;
-        curr->freq = -1;
-        _size--;
-        return retFreq;
+        close(fd);
+        return size == 0 || data != NULL;
     }
 
-    size_t size() const {
-        return _size;
-    }
-
-    void deleteTree(Node* node) {
-        for (auto& pair : node->child) {
-            deleteTree(pair.second);
-        }
-        delete node;
+    // Line starting at offset, without newline
+    string line(uint64_t offset) const {
+        const char* end = (const char*)memchr(data + offset, '\n', size - offset);
+        return string(data + offset, end != NULL ? end : data + size);
     }
 };
 
-FrequentPatterns parse(string filename) {
-    FrequentPatterns fps;
-    ifstream file(filename);
-    if (file.is_open()) {
-        string str;
-        while (getline(file, str)) {
-            vector<int> pt;
-            pt.reserve(200);
-            double freq;
-
-            size_t sep = str.find(':');
-            if (sep == string::npos) {
-                cerr << "Err: Wrong format.\n";
-                exit(1);
-            }
-
-            freq = stof(str.substr(sep + 1, string::npos));
+inline uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
 
-            str = str.substr(0, sep);
-            size_t start = 0;
-            size_t end = str.find(',');
+// Parse "{item},{item}...:{support}" of [ptr, end), false on wrong format
+bool parse_line(const char* ptr, const char* end, vector<uint32_t>& items, Entry& entry) {
+    const char* sep = (const char*)memchr(ptr, ':', end - ptr);
+    if (sep == NULL)
+        return false;
+    items.clear();
+    while (ptr < sep) {
+        uint32_t item = 0;
+        const char* begin = ptr;
+        for (; ptr < sep && (unsigned)(*ptr - '0') < 10; ptr++)
+            item = item * 10 + (*ptr - '0');
+        if (ptr == begin)
+            return false;
+        items.emplace_back(item);
+        if (ptr < sep && *ptr++ != ',')
+            return false;
+    }
+    if (items.empty())
+        return false;
+    sort(items.begin(), items.end());
+    uint64_t h1 = 0x9e3779b97f4a7c15ULL, h2 = 0x7f4a7c159e3779b9ULL;
+    for (uint32_t item : items) {
+        h1 = mix(h1 ^ item);
+        h2 = mix(h2 + item * 0x9e3779b97f4a7c15ULL);
+    }
+    entry.hash = h1;
+    entry.check = (uint32_t)h2;
 
-            while (true) {
-                int item = stoi(str.substr(start, end - start));
-                pt.emplace_back(item);
-                if (end == string::npos)
-                    break;
-                start = end + 1;
-                end = str.find(',', start);
+    // fixed point support, digits past the sixth decimal are rounded
+    ptr = sep + 1;
+    uint64_t whole = 0, frac = 0, scale = 1000000;
+    const char* begin = ptr;
+    for (; ptr < end && (unsigned)(*ptr - '0') < 10; ptr++)
+        whole = whole * 10 + (*ptr - '0');
+    if (ptr < end && *ptr == '.') {
+        for (ptr++; ptr < end && (unsigned)(*ptr - '0') < 10; ptr++) {
+            if (scale > 1) {
+                scale /= 10;
+                frac += (*ptr - '0') * scale;
+            } else if (scale == 1) {
+                frac += *ptr >= '5';
+                scale = 0;
             }
-            sort(pt.begin(), pt.end());
-            fps.insert(pt, freq);
         }
-        file.close();
-    } else {
-        cerr << "Err: File not opened.\n";
-        exit(1);
     }
-    cout << "Parsed " << filename << "\n";
-    return fps;
+    while (ptr < end && (*ptr == '\r' || *ptr == ' '))
+        ptr++;
+    if (ptr == begin || ptr != end || whole > 4000)
+        return false;
+    entry.sup = whole * 1000000 + frac;
+    return true;
 }
 
-void deparse(string filename, FrequentPatterns& fps) {
-    ifstream file(filename);
-    if (file.is_open()) {
-        string str;
-        while (getline(file, str)) {
-            vector<int> pt;
-            pt.reserve(200);
-            double freq;
-
-            size_t sep = str.find(':');
-            assert(sep != string::npos);
-
-            freq = stof(str.substr(sep + 1, string::npos));
-
-            str = str.substr(0, sep);
-            size_t start = 0;
-            size_t end = str.find(',');
-
-            while (true) {
-                int item = stoi(str.substr(start, end - start));
-                pt.emplace_back(item);
-                if (end == string::npos)
-                    break;
-                start = end + 1;
-                end = str.find(',', start);
-            }
-            sort(pt.begin(), pt.end());
+// Parse file in newline aligned chunks, one per thread, false on wrong format
+bool parse(MappedFile& file, int n_threads) {
+    int n_chunks = max(1, min(n_threads, (int)(file.size / (1 << 20))));
+    vector<const char*> bounds(n_chunks + 1, file.data + file.size);
+    bounds[0] = file.data;
+    for (int i = 1; i < n_chunks; i++) {
+        const char* ptr = max(file.data + file.size * i / n_chunks, bounds[i - 1]);
+        const char* newline = (const char*)memchr(ptr, '\n', file.data + file.size - ptr);
+        bounds[i] = newline != NULL ? newline + 1 : file.data + file.size;
+    }
 
-            if (fps.pop(pt) != freq) {
-                cerr << "Err: Freqeuncy not matched.\n";
-                exit(1);
+    file.parts.assign(n_chunks, vector<vector<Entry>>(NPARTITIONS));
+    vector<int64_t> bad(n_chunks, -1);
+#pragma omp parallel for num_threads(n_chunks) schedule(static, 1)
+    for (int c = 0; c < n_chunks; c++) {
+        vector<uint32_t> items;
+        for (const char* ptr = bounds[c]; ptr < bounds[c + 1];) {
+            const char* newline = (const char*)memchr(ptr, '\n', bounds[c + 1] - ptr);
+            const char* end = newline != NULL ? newline : bounds[c + 1];
+            Entry entry;
+            entry.offset = ptr - file.data;
+            if (!parse_line(ptr, end, items, entry)) {
+                bad[c] = entry.offset;
+                break;
             }
+            file.parts[c][entry.hash >> (64 - PARTITIONBITS)].emplace_back(entry);
+            ptr = end + 1;
         }
-        file.close();
-    } else {
-        cerr << "Err: File not opened.\n";
-        exit(1);
     }
-
-    if (fps.size() != 0) {
-        cerr << "Remain " << fps.size() << " lines.\n";
-        cerr << "Err: Not equal number of lines.\n";
-        exit(1);
+    for (int c = 0; c < n_chunks; c++) {
+        if (bad[c] >= 0) {
+            cerr << "Err: Wrong format in " << file.name << ": " << file.line(bad[c]) << "\n";
+            return false;
+        }
     }
-    cout << "Deparsed " << filename << "\n";
+    return true;
 }
 
 int main(int argc, char** argv) {
-    assert(argc == 3);
-    string file1 = argv[1];
-    string file2 = argv[2];
+    if (argc != 3) {
+        cerr << "usage: " << argv[0] << " {expected} {actual}\n";
+        return 1;
+    }
+    int n_threads = omp_get_max_threads();
+    MappedFile files[2];
+    for (int f = 0; f < 2; f++) {
+        if (!files[f].open(argv[f + 1])) {
+            cerr << "Err: File not opened.\n";
+            return 1;
+        }
+        if (!parse(files[f], n_threads))
+            return 1;
+        cout << "Parsed " << argv[f + 1] << "\n";
+    }
+
+    // sort each partition of both files and merge them
+    size_t n_lines[2] = {0, 0}, n_repeated = 0, n_missing = 0, n_unexpected = 0, n_support = 0;
+    vector<vector<string>> examples(4);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(n_threads) reduction(+ : n_repeated, n_missing, n_unexpected, n_support)
+    for (int p = 0; p < NPARTITIONS; p++) {
+        vector<Entry> part[2];
+        for (int f = 0; f < 2; f++) {
+            for (auto& chunk : files[f].parts)
+                part[f].insert(part[f].end(), chunk[p].begin(), chunk[p].end());
+            sort(part[f].begin(), part[f].end());
+#pragma omp atomic
+            n_lines[f] += part[f].size();
+        }
+        auto example = [&](int kind, const string& line) {
+#pragma omp critical
+            if (examples[kind].size() < MAXEXAMPLES)
+                examples[kind].emplace_back(line);
+        };
+        for (int f = 0; f < 2; f++) {
+            for (size_t i = 1; i < part[f].size(); i++) {
+                if (part[f][i].samePattern(part[f][i - 1])) {
+                    n_repeated++;
+                    example(0, files[f].name + ": " + files[f].line(part[f][i].offset));
+                }
+            }
+        }
+        size_t i = 0, j = 0;
+        while (i < part[0].size() || j < part[1].size()) {
+            if (j == part[1].size() || (i < part[0].size() && part[0][i] < part[1][j])) {
+                n_missing++;
+                example(1, files[0].line(part[0][i++].offset));
+            } else if (i == part[0].size() || part[1][j] < part[0][i]) {
+                n_unexpected++;
+                example(2, files[1].line(part[1][j++].offset));
+            } else {
+                if (part[0][i].sup != part[1][j].sup) {
+                    n_support++;
+                    example(3, files[0].line(part[0][i].offset) + " vs " + files[1].line(part[1][j].offset));
+                }
+                i++;
+                j++;
+            }
+        }
+    }
 
-    FrequentPatterns fps = parse(file1);
-    deparse(file2, fps);
+    const char* kinds[4] = {"repeated", "missing", "unexpected", "support differs"};
+    for (int k = 0; k < 4; k++) {
+        for (auto& line : examples[k])
+            cerr << kinds[k] << ": " << line << "\n";
+    }
+    if (n_repeated > 0)
+        cerr << "Err: Repeated frequent patterns, " << n_repeated << " lines.\n";
+    if (n_missing > 0 || n_unexpected > 0)
+        cerr << "Err: Pattern not matched, " << n_missing << " missing, " << n_unexpected << " unexpected of " << n_lines[0] << " expected and "
+             << n_lines[1] << " actual lines.\n";
+    if (n_support > 0)
+        cerr << "Err: Frequency not matched, " << n_support << " patterns.\n";
+    if (n_repeated > 0 || n_missing > 0 || n_unexpected > 0 || n_support > 0)
+        return 1;
     cout << "Passed\n";
+    return 0;
 }
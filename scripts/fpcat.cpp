@@ -0,0 +1,161 @@
+// Convert binary pattern output of --binary or --binary=zlib back to text lines "{items}:{support}"
+// usage: ./fpcat {binary_file} [{text_file}]
+// text goes to stdout without text_file, lines are in the order of the records
+// compressed files need a build with -DFPZLIB and -lz, make ZLIB=1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef FPZLIB
+#include <zlib.h>
+#endif  // FPZLIB
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define PATTERNMAGIC "FPPAT1\0\0"
+// text is written out once it reaches this many bytes
+#define TEXTCHUNK (1 << 20)
+
+struct Header {
+    uint32_t flags;
+    std::vector<uint32_t> item_ids;  // original id of each rank
+    uint64_t n_trxns;
+};
+
+// Read LEB128 varint at ptr, false if it runs past end
+bool read_varint(const uint8_t*& ptr, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && ptr < end; shift += 7) {
+        uint8_t byte = *ptr++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Decode records of [ptr, end) as text to out, false on a broken record or write error
+bool decode(const uint8_t* ptr, const uint8_t* end, const Header& header, FILE* out) {
+    // input without transactions has no patterns
+    if (ptr < end && header.n_trxns == 0)
+        return false;
+    std::string prev, pattern, text;
+    char sup[16];
+    while (ptr < end) {
+        uint32_t shared, len, cnt;
+        if (!read_varint(ptr, end, shared) || !read_varint(ptr, end, len) || shared > prev.size() || len > (size_t)(end - ptr))
+            return false;
+        pattern.assign(prev, 0, shared);
+        pattern.append((const char*)ptr, len);
+        ptr += len;
+        if (!read_varint(ptr, end, cnt))
+            return false;
+
+        const uint8_t* item = (const uint8_t*)pattern.data();
+        const uint8_t* item_end = item + pattern.size();
+        if (item == item_end)
+            return false;
+        while (item < item_end) {
+            uint32_t rank;
+            if (!read_varint(item, item_end, rank) || rank >= header.item_ids.size())
+                return false;
+            text += std::to_string(header.item_ids[rank]);
+            text += ',';
+        }
+        // same as the text output of the miner
+        snprintf(sup, sizeof(sup), ":%.4f\n", (double)cnt / header.n_trxns);
+        text.pop_back();
+        text += sup;
+        prev.swap(pattern);
+        if (text.size() >= TEXTCHUNK) {
+            if (fwrite(text.data(), 1, text.size(), out) != text.size())
+                return false;
+            text.clear();
+        }
+    }
+    return fwrite(text.data(), 1, text.size(), out) == text.size();
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2 && argc != 3) {
+        std::cerr << "usage: " << argv[0] << " {binary_file} [{text_file}]\n";
+        return 1;
+    }
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        std::cerr << "Err: File not opened.\n";
+        return 1;
+    }
+    size_t size = st.st_size;
+    const uint8_t* data = size > 0 ? (const uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (size < 24 || data == MAP_FAILED || memcmp(data, PATTERNMAGIC, 8) != 0) {
+        std::cerr << "Err: Not a binary pattern file.\n";
+        return 1;
+    }
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+
+    Header header;
+    uint32_t n_ranks;
+    memcpy(&header.flags, data + 8, 4);
+    memcpy(&n_ranks, data + 12, 4);
+    memcpy(&header.n_trxns, data + 16, 8);
+    if (size < 24 + 4 * (size_t)n_ranks) {
+        std::cerr << "Err: Broken header.\n";
+        return 1;
+    }
+    header.item_ids.resize(n_ranks);
+    memcpy(header.item_ids.data(), data + 24, 4 * (size_t)n_ranks);
+
+#ifndef FPZLIB
+    if (header.flags & 1) {
+        std::cerr << "Err: Built without FPZLIB, compressed blocks can not be read.\n";
+        return 1;
+    }
+#endif  // FPZLIB
+    FILE* out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        std::cerr << "Err: File not opened.\n";
+        return 1;
+    }
+    const uint8_t* ptr = data + 24 + 4 * (size_t)n_ranks;
+    const uint8_t* end = data + size;
+    bool ok = true;
+    if (header.flags & 1) {
+#ifdef FPZLIB
+        // blocks of u32 raw length, u32 compressed length and deflate data, one per buffer of the miner
+        std::vector<uint8_t> raw;
+        while (ok && ptr < end) {
+            uint32_t raw_len, packed_len;
+            if (end - ptr < 8) {
+                ok = false;
+                break;
+            }
+            memcpy(&raw_len, ptr, 4);
+            memcpy(&packed_len, ptr + 4, 4);
+            ptr += 8;
+            raw.resize(raw_len);
+            uLongf len = raw_len;
+            ok = packed_len <= (size_t)(end - ptr) && uncompress(raw.data(), &len, ptr, packed_len) == Z_OK && len == raw_len &&
+                 decode(raw.data(), raw.data() + raw_len, header, out);
+            ptr += packed_len;
+        }
+#endif  // FPZLIB
+    } else {
+        ok = decode(ptr, end, header, out);
+    }
+    munmap((void*)data, size);
+    if (out != stdout)
+        ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        std::cerr << "Err: Broken records in " << argv[1] << "\n";
+        return 1;
+    }
+    return 0;
+}